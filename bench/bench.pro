@@ -0,0 +1,35 @@
+QT += core gui opengl
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = tessellate
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += \
+    ../src/parts \
+    ../src/thirdparty/glm \
+    ../src/thirdparty/triangle
+
+SOURCES += \
+    tessellate.cpp \
+    ../src/thirdparty/triangle/triangle.c
+
+HEADERS += \
+    ../src/parts/gdsii.h \
+    ../src/parts/mesh.h \
+    ../src/parts/meshcache.h \
+    ../src/parts/scanline.h \
+    ../src/thirdparty/triangle/triangle.h
+
+# For compilation of Triangle library (as in gdsiiview.pro):
+QMAKE_CFLAGS += -O1
+QMAKE_CFLAGS += -DNO_TIMER
+QMAKE_CFLAGS += -DTRILIBRARY
+win32{
+    QMAKE_CFLAGS += -DCPU86
+}
+unix:!macx{
+    QMAKE_CFLAGS += -DLINUX
+}
+CONFIG += warn_off
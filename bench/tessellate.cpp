@@ -0,0 +1,346 @@
+// Benchmark of the tessellation of one layer (Mesh::prepare()), on a
+// synthetic layout or on any GDSII file.
+//
+// Usage:
+//     tessellate mixed|wires|random|combs|array [count] [--merge]
+//     tessellate <file.gds> <layer> [datatype] [--merge]
+//
+// The synthetic layouts are written to a GDSII file in the temporary
+// directory (all boundaries on layer 1, datatype 0, 1000 database units per
+// um), read back as a part would read it, and tessellated without the mesh
+// cache:
+//     mixed   (count) boundaries, flat: 90% rectangles, 7% octagons, 3% L
+//             shapes (default 1000000)
+//     wires   about (count) overlapping wire segments of a metal-like
+//             grid (default 130000); try with --merge
+//     random  (count) random, sparse rectangles (default 100000)
+//     combs   (count) copies of 50 non-convex comb shapes (default 100000)
+//     array   a (count) x (count) AREF of a cell of 11 boundaries
+//             (default 200)
+// The mesh prints how many boundaries were capped by fans and how many by
+// Triangle, and the time taken in all and for the hull; this program then
+// prints the size of the mesh, and the size it would have if every
+// instance of every master were tessellated in place. Mesh uses every
+// core; run under e.g. "taskset -c 0" to time one. Where there is no
+// display, add "-platform offscreen" (a Qt option).
+
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QSurfaceFormat>
+#include <QDir>
+#include <QDebug>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "gdsii.h"
+#include "mesh.h"
+
+////////// GDSII WRITER ///////////////////////////////////////////////////////
+
+static void write_record(FILE* file, uint8_t record_type, uint8_t data_type, const std::vector<uint8_t>& data){
+    size_t length = 4 + data.size();
+    uint8_t header[] = {(uint8_t)(length >> 8), (uint8_t)length, record_type, data_type};
+    fwrite(header, 1, 4, file);
+    if(!data.empty()){ fwrite(data.data(), 1, data.size(), file); }
+}
+
+static void write_int16(FILE* file, uint8_t record_type, const std::vector<int16_t>& values){
+    std::vector<uint8_t> data;
+    for(size_t i=0; i<values.size(); i++){
+        data.push_back((uint16_t)values[i] >> 8);
+        data.push_back((uint16_t)values[i]);
+    }
+    write_record(file, record_type, values.empty() ? DATA_TYPE_NODATA : DATA_TYPE_INT16, data);
+}
+
+static void write_int32(FILE* file, uint8_t record_type, const std::vector<int32_t>& values){
+    std::vector<uint8_t> data;
+    for(size_t i=0; i<values.size(); i++){
+        for(int shift=24; shift>=0; shift-=8){
+            data.push_back((uint32_t)values[i] >> shift);
+        }
+    }
+    write_record(file, record_type, DATA_TYPE_INT32, data);
+}
+
+// GDSII 8-byte real: sign bit, 7-bit exponent (power of 16, excess 64),
+// and 56-bit mantissa (a fraction of at least 1/16).
+static void write_real64(FILE* file, uint8_t record_type, const std::vector<REAL64>& values){
+    std::vector<uint8_t> data;
+    for(size_t i=0; i<values.size(); i++){
+        uint64_t bits = 0;
+        REAL64 value = std::fabs(values[i]);
+        if(value > 0){
+            int exponent = 64;
+            while(value >= 1){ value /= 16; exponent++; }
+            while(value < 1.0/16){ value *= 16; exponent--; }
+            bits = ((uint64_t)(values[i] < 0) << 63) | ((uint64_t)exponent << 56) |
+                   (uint64_t)(value*72057594037927936.0); // (2^56)
+        }
+        for(int shift=56; shift>=0; shift-=8){
+            data.push_back(bits >> shift);
+        }
+    }
+    write_record(file, record_type, DATA_TYPE_REAL64, data);
+}
+
+static void write_string(FILE* file, uint8_t record_type, const char* string){
+    std::vector<uint8_t> data(string, string+strlen(string));
+    if(data.size()%2 == 1){ data.push_back(0); } // (records have even length)
+    write_record(file, record_type, DATA_TYPE_ASCII, data);
+}
+
+static void begin_library(FILE* file){
+    write_int16(file, RECORD_TYPE_HEADER, {600});
+    write_int16(file, RECORD_TYPE_BGNLIB, std::vector<int16_t>(12, 0));
+    write_string(file, RECORD_TYPE_LIBNAME, "BENCH");
+    write_real64(file, RECORD_TYPE_UNITS, {1e-3, 1e-9}); // (um and m per database unit)
+}
+
+static void begin_structure(FILE* file, const char* name){
+    write_int16(file, RECORD_TYPE_BGNSTR, std::vector<int16_t>(12, 0));
+    write_string(file, RECORD_TYPE_STRNAME, name);
+}
+
+// Boundary on layer 1 through (xy) (each x, y; closed here).
+static void write_boundary(FILE* file, std::vector<int32_t> xy){
+    xy.push_back(xy[0]);
+    xy.push_back(xy[1]);
+    write_int16(file, RECORD_TYPE_BOUNDARY, {});
+    write_int16(file, RECORD_TYPE_LAYER, {1});
+    write_int16(file, RECORD_TYPE_DATATYPE, {0});
+    write_int32(file, RECORD_TYPE_XY, xy);
+    write_int16(file, RECORD_TYPE_ENDEL, {});
+}
+
+////////// SHAPES /////////////////////////////////////////////////////////////
+
+// (all counterclockwise, with (x), (y) the lower left corner of the
+// bounding box, in database units)
+
+static std::vector<int32_t> rectangle(int32_t x, int32_t y, int32_t w, int32_t h){
+    return {x, y, x+w, y, x+w, y+h, x, y+h};
+}
+
+static std::vector<int32_t> octagon(int32_t x, int32_t y, int32_t side){
+    int32_t c = side*29/100; // (corner cut, for about equal sides)
+    return {x+c, y, x+side-c, y, x+side, y+c, x+side, y+side-c,
+            x+side-c, y+side, x+c, y+side, x, y+side-c, x, y+c};
+}
+
+static std::vector<int32_t> ell(int32_t x, int32_t y, int32_t w, int32_t h, int32_t t){
+    return {x, y, x+w, y, x+w, y+t, x+t, y+t, x+t, y+h, x, y+h};
+}
+
+// Comb (shape) of 50: a spine with 2-11 teeth of 5 lengths.
+static std::vector<int32_t> comb(int32_t x, int32_t y, int shape){
+    int teeth = 2 + shape%10;
+    int32_t pitch = 400, tooth = 200, spine = 300, length = 1000 + 200*(shape/10);
+    int32_t w = (teeth-1)*pitch + tooth;
+    std::vector<int32_t> xy = {x, y, x+w, y, x+w, y+spine+length, x+w-tooth, y+spine+length, x+w-tooth, y+spine};
+    for(int i=teeth-2; i>=1; i--){
+        int32_t left = x + i*pitch;
+        std::vector<int32_t> notch = {left+tooth, y+spine, left+tooth, y+spine+length,
+                                      left, y+spine+length, left, y+spine};
+        xy.insert(xy.end(), notch.begin(), notch.end());
+    }
+    std::vector<int32_t> first = {x+tooth, y+spine, x+tooth, y+spine+length, x, y+spine+length};
+    xy.insert(xy.end(), first.begin(), first.end());
+    return xy;
+}
+
+////////// LAYOUTS ////////////////////////////////////////////////////////////
+
+const char* const layouts[] = {"mixed", "wires", "random", "combs", "array"};
+const size_t default_counts[] = {1000000, 130000, 100000, 100000, 200};
+
+// Write layout (name) with (count) boundaries (or a lattice (count) on a
+// side) to (filepath).
+static bool write_layout(const std::string& name, size_t count, const char* filepath){
+    FILE* file = fopen(filepath, "wb");
+    if(file == NULL){ return false; }
+    std::mt19937 random(1); // (same layout every run)
+    auto uniform = [&](int32_t min, int32_t max){ return std::uniform_int_distribution<int32_t>(min, max)(random); };
+    begin_library(file);
+    if(name == "array"){
+        begin_structure(file, "CELL"); // (10 rectangles and an L in 10 um)
+        for(int i=0; i<10; i++){
+            write_boundary(file, rectangle(500 + 900*i, 500 + 300*(i%3), 600, 2000 + 500*(i%4)));
+        }
+        write_boundary(file, ell(500, 5000, 9000, 4500, 600));
+        write_int16(file, RECORD_TYPE_ENDSTR, {});
+    }
+    begin_structure(file, "TOP");
+    size_t side = (size_t)std::ceil(std::sqrt((double)count)); // (boundaries along each side of a grid)
+    if(name == "mixed"){
+        for(size_t i=0; i<count; i++){
+            int32_t x = 2000*(i%side), y = 2000*(i/side);
+            int kind = uniform(0, 99);
+            if(kind < 90){
+                write_boundary(file, rectangle(x, y, uniform(200, 1500), uniform(200, 1500)));
+            }else if(kind < 97){
+                write_boundary(file, octagon(x, y, uniform(600, 1800)));
+            }else{
+                write_boundary(file, ell(x, y, uniform(600, 1500), uniform(600, 1500), 300));
+            }
+        }
+    }else if(name == "wires"){
+        // horizontal tracks on a 1 um pitch, and vertical straps on a 10 um
+        // pitch, in 20 um segments that overlap by 1 um
+        size_t segments = std::max((size_t)1, (size_t)std::llround(std::sqrt(count/22.0))); // (along each track)
+        size_t tracks = 20*segments; // (so the grid is square)
+        for(size_t t=0; t<tracks; t++){
+            for(size_t s=0; s<segments; s++){
+                write_boundary(file, rectangle(20000*s, 1000*t, 21000, 200));
+            }
+        }
+        for(size_t t=0; t<2*segments; t++){
+            for(size_t s=0; s<segments; s++){
+                write_boundary(file, rectangle(10000*t, 20000*s, 400, 21000));
+            }
+        }
+    }else if(name == "random"){
+        int32_t extent = 4000*side;
+        for(size_t i=0; i<count; i++){
+            write_boundary(file, rectangle(uniform(0, extent), uniform(0, extent), uniform(200, 3000), uniform(200, 3000)));
+        }
+    }else if(name == "combs"){
+        for(size_t i=0; i<count; i++){
+            write_boundary(file, comb(5000*(i%side), 5000*(i/side), i%50));
+        }
+    }else{
+        int16_t n = (int16_t)std::min(count, (size_t)32767);
+        write_int16(file, RECORD_TYPE_AREF, {});
+        write_string(file, RECORD_TYPE_SNAME, "CELL");
+        write_int16(file, RECORD_TYPE_COLROW, {n, n});
+        write_int32(file, RECORD_TYPE_XY, {0, 0, 10000*n, 0, 0, 10000*n});
+        write_int16(file, RECORD_TYPE_ENDEL, {});
+    }
+    write_int16(file, RECORD_TYPE_ENDSTR, {});
+    write_int16(file, RECORD_TYPE_ENDLIB, {});
+    fclose(file);
+    return true;
+}
+
+////////// MAIN ///////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]){
+    QGuiApplication app(argc, argv); // (removes Qt options from argv)
+
+    std::vector<std::string> args;
+    bool merge = false;
+    for(int i=1; i<argc; i++){
+        if(strcmp(argv[i], "--merge") == 0){ merge = true; }
+        else{ args.push_back(argv[i]); }
+    }
+    if(args.empty()){
+        fprintf(stderr, "usage: tessellate mixed|wires|random|combs|array [count] [--merge]\n"
+                        "       tessellate <file.gds> <layer> [datatype] [--merge]\n");
+        return 1;
+    }
+
+    // synthetic layout, or a GDSII file
+    std::string filepath = args[0];
+    int layer = 1, datatype = 0;
+    for(unsigned int i=0; i<sizeof(layouts)/sizeof(layouts[0]); i++){
+        if(args[0] != layouts[i]){ continue; }
+        size_t count = args.size() > 1 ? std::stoul(args[1]) : default_counts[i];
+        filepath = QDir::temp().filePath(QString("gdsiiview-bench-%1-%2.gds").arg(layouts[i]).arg(count)).toStdString();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if(!write_layout(args[0], count, filepath.c_str())){
+            fprintf(stderr, "could not write %s\n", filepath.c_str());
+            return 1;
+        }
+        qDebug() << "Wrote" << layouts[i] << "layout of" << count << "to" << filepath.c_str() << "in"
+                 << std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() << "s";
+    }
+    if(filepath == args[0]){
+        if(args.size() < 2){
+            fprintf(stderr, "no layer given for %s\n", filepath.c_str());
+            return 1;
+        }
+        layer = std::stoi(args[1]);
+        datatype = args.size() > 2 ? std::stoi(args[2]) : -1;
+    }
+
+    // Mesh needs an OpenGL context, though prepare() does not draw
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+    QOpenGLContext context;
+    context.setFormat(format);
+    if(!context.create() || !context.makeCurrent(&surface)){
+        fprintf(stderr, "could not make an OpenGL 3.3 context\n");
+        return 1;
+    }
+
+    // read and index the layer as Part::prepare() does
+    GDSII* gdsii = gdsii_create_gdsii();
+    GDSII_FILTER filter;
+    gdsii_create_filter(&filter);
+    gdsii_filter_add(&filter, layer, datatype);
+    GDSII_READ_STATS stats;
+    if(!gdsii_read(gdsii, filepath.c_str(), GDSII_READER_PARALLEL, &stats, &filter)){
+        fprintf(stderr, "could not read %s\n", filepath.c_str());
+        return 1;
+    }
+    std::vector<GDSII_LAYER> layers(1);
+    layers[0].layer = layer;
+    layers[0].datatype = datatype;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    gdsii_index_layers(gdsii, layers);
+    qDebug() << "Read" << stats.bytes << "bytes in" << stats.seconds << "s; indexed layer in"
+             << std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() << "s";
+
+    Mesh mesh;
+    mesh.gdsii = gdsii;
+    mesh.layer = &layers[0];
+    mesh.gdslayer = layer;
+    mesh.gdsdatatype = datatype;
+    mesh.merge = merge;
+    start = std::chrono::steady_clock::now();
+    mesh.prepare();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    // Size of the mesh as uploaded, and as if every instance of a master
+    // were a copy of it (see Mesh::upload()); points of a master are taken
+    // to be those from its first to its last one used.
+    size_t bytes = mesh.prepared_points.size()*sizeof(int16_t) + mesh.prepared_origins.size()*sizeof(int32_t) +
+                   mesh.prepared_indices.size()*sizeof(uint32_t) + mesh.prepared_edges.size()*sizeof(uint32_t) +
+                   mesh.placements.size()*sizeof(MESH_PLACEMENT);
+    size_t expanded = 0, num_triangles = 0, num_instances = 0;
+    for(size_t m=0; m<mesh.masters.size(); m++){
+        const MESH_MASTER& master = mesh.masters[m];
+        uint32_t min = std::numeric_limits<uint32_t>::max(), max = 0;
+        for(size_t i=master.first_index; i<master.first_index+master.num_indices; i++){
+            min = std::min(min, mesh.prepared_indices[i]/2);
+            max = std::max(max, mesh.prepared_indices[i]/2);
+        }
+        for(size_t i=2*master.first_wall; i<2*(master.first_wall+master.num_walls); i++){
+            min = std::min(min, mesh.prepared_edges[i]);
+            max = std::max(max, mesh.prepared_edges[i]);
+        }
+        size_t master_bytes = (max >= min ? (size_t)(max-min+1)*2*sizeof(int16_t) : 0) +
+                              master.num_indices*sizeof(uint32_t) + 2*master.num_walls*sizeof(uint32_t);
+        for(size_t p=master.first_placement; p<master.first_placement+master.num_placements; p++){
+            size_t copies = (size_t)(mesh.placements[p].columns*mesh.placements[p].rows);
+            num_instances += copies;
+            num_triangles += copies*(master.num_indices/3 + 2*master.num_walls);
+            expanded += copies*master_bytes;
+        }
+    }
+    qDebug() << "Prepared mesh in" << seconds << "s:" << num_triangles << "triangles," << mesh.masters.size()
+             << "masters," << num_instances << "instances," << bytes << "bytes (" << expanded
+             << "bytes if tessellated in place)";
+
+    gdsii_delete_gdsii(gdsii);
+    return 0;
+}
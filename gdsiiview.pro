@@ -18,11 +18,17 @@ SOURCES += \
 HEADERS += \
     src/parts/image.h \
     src/parts/mesh.h \
+    src/parts/meshcache.h \
     src/window.h \
     src/canvas.h \
     src/axes.h \
     src/parts/part.h \
     src/parts/gdsii.h \
+    src/parts/loader.h \
+    src/parts/raster.h \
+    src/parts/renderqueue.h \
+    src/parts/scanline.h \
+    src/parts/shader.h \
     src/thirdparty/triangle/triangle.h
 
 # For compilation of Triangle library:
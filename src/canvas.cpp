@@ -14,18 +14,29 @@ Canvas::Canvas() {
     watcher = new QFileSystemWatcher(this);
     // TODO: this stops registering watches after ~5-20 file changes on Windows?!
     connect(watcher, &QFileSystemWatcher::fileChanged, this, &Canvas::update_file);
+
+    load_timer = new QTimer(this);
+    load_timer->setInterval(15); // (milliseconds)
+    connect(load_timer, &QTimer::timeout, this, &Canvas::continue_loading);
 }
 
 Canvas::~Canvas(){
     makeCurrent(); // reinitialize OpenGL to correctly free GPU memory in destructors
+    delete loader;
+    for(unsigned int i=0; i<retired_loaders.size(); i++){
+        delete retired_loaders[i];
+    }
     delete watcher;
     delete axes;
+    delete queue;
 }
 
 void Canvas::initializeGL(){
     initializeOpenGLFunctions();
     glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE); // (all faces wind counterclockwise seen from outside)
     axes = new Axes();
+    queue = new RenderQueue();
 }
 
 void Canvas::resizeGL(int width, int height){
@@ -37,23 +48,23 @@ void Canvas::paintGL(){
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     //transform XYZ device space to screen XY
-    glm::mat4 view;
-    view = glm::ortho(-0.5f*screen_size.x/screen_size.y, 0.5f*screen_size.x/screen_size.y, -0.5f, 0.5f, -100.0f, 100.0f);
-    glm::mat4 rotate = glm::mat4(1.0f);
-    rotate = glm::rotate(rotate, glm::radians(240.0f), glm::vec3(0.5773503f, 0.5773503f, 0.5773503f));
-    rotate = glm::rotate(rotate, glm::radians(90-camera_phi), glm::vec3(0.0f, 1.0f, 0.0f));
-    rotate = glm::rotate(rotate, glm::radians(-camera_theta), glm::vec3(0.0f, 0.0f, 1.0f));
-    view = view*rotate;
+    glm::mat4 projection = glm::ortho(-0.5f*screen_size.x/screen_size.y, 0.5f*screen_size.x/screen_size.y, -0.5f, 0.5f, -100.0f, 100.0f);
+    glm::mat4 view = glm::mat4(1.0f);
+    view = glm::rotate(view, glm::radians(240.0f), glm::vec3(0.5773503f, 0.5773503f, 0.5773503f));
+    view = glm::rotate(view, glm::radians(90-camera_phi), glm::vec3(0.0f, 1.0f, 0.0f));
+    view = glm::rotate(view, glm::radians(-camera_theta), glm::vec3(0.0f, 0.0f, 1.0f));
     if(show_axes){
-        axes->render(view);
+        axes->render(projection*view);
     }
     view = glm::scale(view, glm::vec3(1/camera_zoom, 1/camera_zoom, 1/camera_zoom));
     view = glm::translate(view, camera_position);
 
+    float pixel_size = camera_zoom/screen_size.y; // (model units)
+    queue->projection = projection;
     for(unsigned int i=0; i<parts.size(); i++){
-        parts[i]->render(view, rotate);
+        parts[i]->render(*queue, view, pixel_size);
     }
-
+    queue->submit();
 
 }
 
@@ -122,11 +133,8 @@ bool Canvas::initialize_from_file(QString filepath){
     watcher->files().clear();
     watcher->addPath(filepath);
 
-    for(unsigned int i=0; i<parts.size(); i++){
-        parts[i]->deinitialize();
-    }
-    parts.clear();
-
+    // parts are shown once loaded (see continue_loading())
+    std::vector<std::shared_ptr<Part>>loaded;
     std::shared_ptr<Part>temppart = std::shared_ptr<Part>(new Part());
     std::shared_ptr<Mesh>tempmesh = std::shared_ptr<Mesh>(new Mesh());
     std::shared_ptr<Image>tempimage = std::shared_ptr<Image>(new Image());
@@ -177,7 +185,7 @@ bool Canvas::initialize_from_file(QString filepath){
                     temppart->image = tempimage;
                     tempimage = std::shared_ptr<Image>(new Image());
                 }
-                parts.push_back(temppart);
+                loaded.push_back(temppart);
             }
             temppart = std::shared_ptr<Part>(new Part());
             temppart->filepath = QDir(relativepath).filePath(QString(commands[1].c_str()));
@@ -189,6 +197,15 @@ bool Canvas::initialize_from_file(QString filepath){
         }else if(commands[0][0] == '#'){ // these are also comments
         }else if(commands[0] == "transform:"){ // really just a placeholder; ignore this line too
         }else if(commands[0] == "geometry:"){ // same
+        }else if(commands[0] == "reader:"){ // how to read GDSII files (to compare speed)
+            if(commands[1]=="stream"){ temppart->gdsii_reader = GDSII_READER_STREAM; }
+            else if(commands[1]=="mapped"){ temppart->gdsii_reader = GDSII_READER_MAPPED; }
+            else if(commands[1]=="parallel"){ temppart->gdsii_reader = GDSII_READER_PARALLEL; }
+            else{ emit_initialization_error(QString("Unknown reader in configuration file at line %1.").arg(linenumber)); return false; }
+        }else if(commands[0] == "cache:"){ // whether to keep tessellated meshes on disk
+            if(commands[1]=="true"){ temppart->use_cache = true; }
+            else if(commands[1]=="false"){ temppart->use_cache = false; }
+            else{ emit_initialization_error(QString("Unknown cache setting in configuration file at line %1.").arg(linenumber)); return false; }
         }else if(commands[0] == "hidden:"){
             if(commands[1]=="true"){ temppart->hidden = true; }
         }else if(commands[0] == "layer:"){
@@ -196,6 +213,12 @@ bool Canvas::initialize_from_file(QString filepath){
             tempmesh = std::shared_ptr<Mesh>(new Mesh());
             tempmesh->gdslayer = std::stoi(commands[1]);
             tempmesh->created = true;
+        }else if(commands[0] == "datatype:"){
+            tempmesh->gdsdatatype = std::stoi(commands[1]);
+        }else if(commands[0] == "merge:"){ // merge overlapping polygons of layer before extruding
+            if(commands[1]=="true"){ tempmesh->merge = true; }
+            else if(commands[1]=="false"){ tempmesh->merge = false; }
+            else{ emit_initialization_error(QString("Unknown merge setting in configuration file at line %1.").arg(linenumber)); return false; }
         }else if(commands[0] == "rotate:"){
             glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);
             switch(commands[1][0]){
@@ -205,7 +228,6 @@ bool Canvas::initialize_from_file(QString filepath){
                 default: emit_initialization_error(QString("Unknown axis in configuration file at line %1.").arg(linenumber)); return false;
             }
             temppart->transform = glm::rotate(glm::mat4(1.0f), glm::radians(std::stof(commands[2])), axis)*temppart->transform;
-            temppart->rotate = glm::rotate(glm::mat4(1.0f), glm::radians(std::stof(commands[2])), axis)*temppart->rotate;
         }else if(commands[0] == "translate:"){
             temppart->transform = glm::translate(glm::mat4(1.0f), glm::vec3(std::stof(commands[1]), std::stof(commands[2]), std::stof(commands[3]))) * temppart->transform;
         }else if(commands[0] == "background:"){
@@ -249,18 +271,56 @@ bool Canvas::initialize_from_file(QString filepath){
         if(temppart->type == Part::PART_IMAGE){
             temppart->image = tempimage;
         }
-        parts.push_back(temppart);
+        loaded.push_back(temppart);
+    }
+
+    // read and tessellate in the background, replacing any earlier load
+    if(loader != nullptr){
+        reset_view = reset_view || loader->reset_view; // (its parts were never shown)
+        loader->cancel = true;
+        retired_loaders.push_back(loader);
+    }
+    loader = new Loader(loaded);
+    loader->reset_view = reset_view;
+    loader->start();
+    load_timer->start();
+
+    return true;
+}
+
+void Canvas::continue_loading(){
+    // free cancelled loads once their threads stop
+    for(unsigned int i=0; i<retired_loaders.size(); i++){
+        if(retired_loaders[i]->finished){
+            makeCurrent();
+            delete retired_loaders[i];
+            retired_loaders.erase(retired_loaders.begin()+i);
+            i--;
+        }
+    }
+    if(loader == nullptr){
+        if(retired_loaders.empty()){ load_timer->stop(); }
+        return;
+    }
+    if(!loader->ready){
+        show_status(loader->progress());
+        return;
     }
 
-    // initialize with OpenGL context
+    // upload a slice, keeping the current parts on screen until all are
     makeCurrent();
+    show_status(QString("Uploading part %1 of %2").arg(loader->next_part+1).arg(loader->parts.size()));
+    if(!loader->upload(upload_seconds)){ return; }
     for(unsigned int i=0; i<parts.size(); i++){
-        parts[i]->initialize();
+        parts[i]->deinitialize();
     }
+    parts = loader->parts;
+    bool reset_view = loader->reset_view;
+    delete loader;
+    loader = nullptr;
+    show_status("");
 
     // redraw
-
-
     if(reset_view){
         camera_position = glm::vec3(0.0f, 0.0f, 0.0f);
         camera_theta = 45.0f;
@@ -269,8 +329,6 @@ bool Canvas::initialize_from_file(QString filepath){
     }else{
         update();
     }
-
-    return true;
 }
 
 void Canvas::update_file(QString filepath){
@@ -362,3 +420,31 @@ void Canvas::view_orient(float theta, float phi){
     camera_phi = phi;
     update();
 }
+
+// Draw the current view with the depth test off, so that every fragment
+// of every face is drawn, once without and once with back-face culling,
+// and report the number of samples drawn per pixel (overdraw) each time.
+void Canvas::measure_overdraw(){
+    makeCurrent();
+    GLuint query;
+    glGenQueries(1, &query);
+    GLuint64 samples[2];
+    for(unsigned int cull=0; cull<2; cull++){
+        if(cull){ glEnable(GL_CULL_FACE); }else{ glDisable(GL_CULL_FACE); }
+        glDisable(GL_DEPTH_TEST);
+        glBeginQuery(GL_SAMPLES_PASSED, query);
+        paintGL();
+        glEndQuery(GL_SAMPLES_PASSED);
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples[cull]);
+    }
+    glDeleteQueries(1, &query);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    update();
+
+    double pixels = std::max(1.0, (double)screen_size.x*screen_size.y*format().samples());
+    QString report = QString("Samples drawn per pixel sample: %1 without back-face culling, %2 with (%3% fewer).")
+        .arg(samples[0]/pixels).arg(samples[1]/pixels).arg(samples[0] > 0 ? 100.0*(1.0-(double)samples[1]/samples[0]) : 0.0);
+    qDebug() << report;
+    QMessageBox::information(this, "Overdraw", report);
+}
@@ -2,7 +2,7 @@
 #define CANVAS_H
 
 #include <QOpenGLWidget>
-#include <QOpenGLFunctions>
+#include <QOpenGLFunctions_3_3_Core>
 #include <QFileSystemWatcher>
 #include <QFileDialog> // open/save dialogs
 #include <QFileInfo>
@@ -17,6 +17,8 @@
 #include <QWheelEvent> // mouse scrolling for zoom
 #include <QString>
 #include <QPoint>
+#include <QTimer>
+#include <functional>
 #include <memory>
 #include <limits>
 #include <iostream>
@@ -26,10 +28,11 @@
 #include "axes.h"
 #include "parts/part.h"
 #include "parts/mesh.h"
+#include "parts/loader.h"
 
 // This class loads and renders a 3D view of a single *.gdsiiview file;
 // it holds a large portion of the entire application code.
-class Canvas : public QOpenGLWidget, protected QOpenGLFunctions {
+class Canvas : public QOpenGLWidget, protected QOpenGLFunctions_3_3_Core {
 public:
 
     // The cursor position and screen size are tracked to manipulate the camera.
@@ -52,6 +55,7 @@ public:
     // Background color displayed behind the loaded model.
     glm::vec3 background_color = glm::vec3(0.1f, 0.1f, 0.1f);
     Axes* axes;
+    RenderQueue* queue = nullptr; // (draws of meshes of every part)
     bool show_axes = true;
 
     // One *.gdsiiview file can be loaded at a time; its filepath is stored
@@ -64,6 +68,18 @@ public:
     QFileSystemWatcher* watcher;
     std::vector<std::shared_ptr<Part>>parts;
 
+    // Files are read and tessellated in the background by (loader), while
+    // (parts) of the file loaded before are still shown; (load_timer) then
+    // uploads the new parts a slice at a time between frames, and swaps
+    // them in. A loader replaced before it is done is cancelled, and kept
+    // in (retired_loaders) until its thread stops. (show_status) is told
+    // what is being loaded (or "" when done).
+    Loader* loader = nullptr;
+    std::vector<Loader*> retired_loaders;
+    QTimer* load_timer;
+    float upload_seconds = 0.008f; // time spent uploading per timer tick (seconds)
+    std::function<void(const QString&)> show_status = [](const QString&){};
+
     Canvas();
     ~Canvas();
     void initializeGL(); // OpenGL is first active in this function
@@ -75,12 +91,14 @@ public:
 
 public slots:
     void update_file(QString filepath); // discard current and load new file
+    void continue_loading(); // report progress of (loader), upload, and swap in
     void center_model_origin();
     void toggle_axes();
     void file_open(); // choose and open file with GUI dialog
     void file_save(); // choose and save rendered image with GUI dialog
     void view_fit(); // adjust zoom to fit model in screen (camera view)
     void view_orient(float theta, float phi); // change to given view
+    void measure_overdraw(); // count fragments drawn with and without back-face culling
 };
 
 #endif // CANVAS_H
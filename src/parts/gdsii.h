@@ -7,13 +7,33 @@
 // but inline to work with Qt/C++ compilation
 
 #include <assert.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::min/std::max usable
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <thread>
+#include <utility>
 
 ////////// GDSII CONSTANTS ////////////////////////////////////////////////////
 
@@ -82,169 +102,680 @@ const uint8_t ELEMENT_TYPE_SREF = 0x03;
 const uint8_t ELEMENT_TYPE_AREF = 0x04;
 const uint8_t ELEMENT_TYPE_BOX = 0x05;
 
+const uint16_t STRANS_REFLECT = 0x8000;         // reflect about x axis before rotation
+const uint16_t STRANS_ABSOLUTE_MAG = 0x0004;    // magnification is absolute
+const uint16_t STRANS_ABSOLUTE_ANGLE = 0x0002;  // angle is absolute
+
 ////////// DATA STRUCTURES ////////////////////////////////////////////////////
 
 typedef float REAL32;       // note: GDSII has its own 32-bit real format!
 typedef double REAL64;      // note: as before. This is for convenience.
 
-struct GDSII_POINT{         // a 2D point
-    REAL32 x, y;            // all data types should be converted to REAL32
-    GDSII_POINT* next;      // (to implement linked list of points)
-};
+// Geometry is stored as flat arrays per structure rather than linked lists:
+// each element has a small fixed-size header, and the points of all elements
+// in a structure are stored contiguously as GDSII integer database units, so
+// element (i) owns points point_offset[i] ... point_offset[i]+point_count[i]-1.
 
-struct GDSII_ELEMENT{       // a boundary, path, reference, or box
+struct GDSII_ELEMENT{       // header of a boundary, path, reference, or box
     uint8_t type;           // type of element
+    uint8_t path_type;      // type of path
     int16_t layer;          // GDSII layer number (0-255)
+    int16_t datatype;       // GDSII datatype number (0-255)
     int32_t width;          // width of path (negative means absolute)
-    uint8_t path_type;      // type of path
-    GDSII_ELEMENT* ref;     // referenced structure (for type SREF, AREF)
-    GDSII_POINT* point;     // linked list of points in this element
-    bool transform;         // whether transformations are applied
-    bool reflect;           // whether to reflect about x-axis
-    bool rotate;            // whether to rotate
-    REAL64 angle;           // rotation angle (degrees)
-    bool angle_is_absolute; // whether angle is absolute (vs. hierarchical)
-    bool magnify;           // whether to magnify
-    REAL64 magnification;   // magnification amount (1 = no effect)
-    bool mag_is_absolute;   // whether magnification is absolute
-    GDSII_ELEMENT* next;    // (to implement linked list of elements)
 };
 
-struct GDSII_STRUCTURE{     // a collection of elements
-    char* name;             // structure name (ASCII, dynamically allocated)
-    GDSII_ELEMENT* element; // linked list of elements in this structure
-    GDSII_STRUCTURE* next;  // (to implement linked list of structures)
+struct GDSII_STRUCTURE;
+
+// SREF and AREF elements additionally have a reference, which places another
+// structure: the structures and references form a directed acyclic graph
+// (cell hierarchy) that is kept as is rather than flattened. The element's
+// points are the placement origin (SREF) or the array origin followed by
+// the displaced column and row corners (AREF).
+struct GDSII_REFERENCE{             // placement of a structure (SREF, AREF)
+    GDSII_STRUCTURE* structure;     // referenced structure (NULL if missing)
+    char* name;                     // referenced structure name (SNAME)
+    uint32_t element;               // index of SREF/AREF element in structure
+    uint16_t strans;                // STRANS flags (reflection, absolute mag/angle)
+    uint16_t columns;               // AREF array size (1 for SREF)
+    uint16_t rows;
+    REAL64 magnification;           // magnification amount (1 = no effect)
+    REAL64 angle;                   // rotation angle (degrees CCW)
+};
+
+struct GDSII_STRUCTURE{         // a collection of elements
+    char* name;                 // structure name (ASCII, in library arena)
+    uint32_t num_elements;      // number of elements in this structure
+    GDSII_ELEMENT* element;     // header of each element
+    uint32_t* point_offset;     // index of first point of each element
+    uint32_t* point_count;      // number of points in each element
+    uint32_t num_points;        // number of points in this structure
+    int32_t* xy;                // coordinates of all points (x0, y0, x1, y1, ...)
+    uint32_t num_references;    // number of SREF and AREF elements
+    GDSII_REFERENCE* reference; // reference of each SREF and AREF element
+    uint32_t num_parents;       // number of references to this structure
+    uint32_t index;             // position in file (set by gdsii_link())
+    GDSII_STRUCTURE* next;      // (to implement linked list of structures)
+};
+
+// Everything in a library is allocated from its arena: a linked list of
+// large blocks that memory is bumped out of. Nothing is freed individually;
+// deleting the library releases the blocks all at once.
+struct GDSII_ARENA_BLOCK{   // header of one block; its memory follows
+    GDSII_ARENA_BLOCK* next;// (to implement linked list of blocks)
+    size_t size;            // usable size of block (bytes)
+    size_t used;            // bytes already handed out
+};
+
+struct GDSII_ARENA{         // a bump allocator
+    GDSII_ARENA_BLOCK* block; // linked list of blocks, newest first
+    size_t bytes;           // total size of all blocks (bytes)
 };
 
 struct GDSII{               // a complete GDSII file
     GDSII_STRUCTURE* structure; // linked list of structures
+    uint32_t num_structures;    // number of structures (set by gdsii_link())
+    GDSII_STRUCTURE** table;    // hash table of structures by name
+    uint32_t table_size;        // (power of two, or 0 if not linked yet)
+    GDSII_STRUCTURE** order;    // all structures, each after those it places
+    GDSII_ARENA arena;      // owns all structures, names, and geometry
 };
 
 ////////// DATA STRUCTURE HANDLERS ////////////////////////////////////////////
 
-inline GDSII_POINT* gdsii_create_point(){
-    GDSII_POINT* point;
-    point = (GDSII_POINT*)malloc(sizeof(GDSII_POINT));
-    (*point).x = 0;
-    (*point).y = 0;
-    (*point).next = NULL;
-    return point;
+const size_t GDSII_ARENA_BLOCK_SIZE = 1 << 20; // default block size (bytes)
+
+inline void gdsii_create_arena(GDSII_ARENA* arena){
+    (*arena).block = NULL;
+    (*arena).bytes = 0;
 }
 
-inline void gdsii_delete_point(GDSII_POINT* point){
-    while(point != NULL){
-        GDSII_POINT* next = (*point).next;
-        free(point);
-        point = next;
+inline void gdsii_delete_arena(GDSII_ARENA* arena){
+    GDSII_ARENA_BLOCK* block = (*arena).block;
+    while(block != NULL){
+        GDSII_ARENA_BLOCK* next = (*block).next;
+        free(block);
+        block = next;
     }
+    (*arena).block = NULL;
+    (*arena).bytes = 0;
 }
 
-inline GDSII_ELEMENT* gdsii_create_element(){
-    GDSII_ELEMENT* element;
-    element = (GDSII_ELEMENT*)malloc(sizeof(GDSII_ELEMENT));
-    (*element).type = ELEMENT_TYPE_UNKNOWN;
-    (*element).layer = 0;
-    (*element).width = 0;
-    (*element).path_type = 0;
-    (*element).ref = NULL;
-    (*element).point = NULL;
-    (*element).transform = false;
-    (*element).reflect = false;
-    (*element).rotate = false;
-    (*element).angle = 0;
-    (*element).angle_is_absolute = false;
-    (*element).magnify = false;
-    (*element).magnification = 1;
-    (*element).mag_is_absolute = false;
-    (*element).next = NULL;
-    return element;
+// Move all blocks of (source) into (arena), leaving (source) empty.
+inline void gdsii_merge_arena(GDSII_ARENA* arena, GDSII_ARENA* source){
+    if((*source).block == NULL){ return; }
+    GDSII_ARENA_BLOCK* last = (*source).block;
+    while((*last).next != NULL){ last = (*last).next; }
+    // keep bumping out of the current block of (arena)
+    if((*arena).block == NULL){
+        (*arena).block = (*source).block;
+    }else{
+        (*last).next = (*(*arena).block).next;
+        (*(*arena).block).next = (*source).block;
+    }
+    (*arena).bytes += (*source).bytes;
+    gdsii_create_arena(source);
 }
 
-inline void gdsii_delete_element(GDSII_ELEMENT* element){
-    while(element != NULL){
-        gdsii_delete_element((*element).ref);
-        gdsii_delete_point((*element).point);
-        GDSII_ELEMENT* next = (*element).next;
-        free(element);
-        element = next;
+// Return (size) bytes of uninitialized memory, aligned to 8 bytes.
+inline void* gdsii_arena_alloc(GDSII_ARENA* arena, size_t size){
+    const size_t header_size = (sizeof(GDSII_ARENA_BLOCK) + 7) & ~(size_t)7;
+    size = (size + 7) & ~(size_t)7;
+    GDSII_ARENA_BLOCK* block = (*arena).block;
+    if(block == NULL || (*block).size - (*block).used < size){
+        size_t block_size = size > GDSII_ARENA_BLOCK_SIZE ? size : GDSII_ARENA_BLOCK_SIZE;
+        GDSII_ARENA_BLOCK* new_block = (GDSII_ARENA_BLOCK*)malloc(header_size + block_size);
+        if(new_block == NULL){ perror("Error! Could not allocate GDSII memory."); abort(); }
+        (*new_block).size = block_size;
+        (*new_block).used = 0;
+        if(block != NULL && size > GDSII_ARENA_BLOCK_SIZE/2){
+            // an oversized allocation gets its own block behind the
+            // current one, which keeps its free space for later bumps
+            (*new_block).next = (*block).next;
+            (*block).next = new_block;
+        }else{
+            (*new_block).next = block;
+            (*arena).block = new_block;
+        }
+        (*arena).bytes += header_size + block_size;
+        block = new_block;
     }
+    void* memory = (uint8_t*)block + header_size + (*block).used;
+    (*block).used += size;
+    return memory;
 }
 
-inline GDSII_STRUCTURE* gdsii_create_structure(){
+inline GDSII_STRUCTURE* gdsii_create_structure(GDSII_ARENA* arena){
     GDSII_STRUCTURE* structure;
-    structure = (GDSII_STRUCTURE*)malloc(sizeof(GDSII_STRUCTURE));
+    structure = (GDSII_STRUCTURE*)gdsii_arena_alloc(arena, sizeof(GDSII_STRUCTURE));
     (*structure).name = NULL;
+    (*structure).num_elements = 0;
     (*structure).element = NULL;
+    (*structure).point_offset = NULL;
+    (*structure).point_count = NULL;
+    (*structure).num_points = 0;
+    (*structure).xy = NULL;
+    (*structure).num_references = 0;
+    (*structure).reference = NULL;
+    (*structure).num_parents = 0;
+    (*structure).index = 0;
     (*structure).next = NULL;
     return structure;
 }
 
-inline void gdsii_delete_structure(GDSII_STRUCTURE* structure){
-    while(structure != NULL){
-        gdsii_delete_element((*structure).element);
-        if((*structure).name != NULL){
-            free((*structure).name);
-        }
-        GDSII_STRUCTURE* next = (*structure).next;
-        free(structure);
-        structure = next;
+// While a structure is read, its elements and points are appended to
+// scratch arrays that are reused for every structure in the file, so
+// creating an element or point is just a pointer bump. When the structure
+// ends, the arrays are copied at their exact size into the library arena.
+struct GDSII_BUILDER{           // scratch arrays for one structure
+    uint32_t num_elements;      // (as in GDSII_STRUCTURE)
+    GDSII_ELEMENT* element;
+    uint32_t* point_offset;
+    uint32_t* point_count;
+    uint32_t num_points;
+    int32_t* xy;
+    uint32_t num_references;
+    GDSII_REFERENCE* reference;
+    uint32_t element_capacity;  // allocated length of element arrays
+    uint32_t point_capacity;    // allocated length of point array (points)
+    uint32_t reference_capacity;// allocated length of reference array
+};
+
+inline void gdsii_create_builder(GDSII_BUILDER* builder){
+    (*builder).num_elements = 0;
+    (*builder).element = NULL;
+    (*builder).point_offset = NULL;
+    (*builder).point_count = NULL;
+    (*builder).num_points = 0;
+    (*builder).xy = NULL;
+    (*builder).num_references = 0;
+    (*builder).reference = NULL;
+    (*builder).element_capacity = 0;
+    (*builder).point_capacity = 0;
+    (*builder).reference_capacity = 0;
+}
+
+inline void gdsii_delete_builder(GDSII_BUILDER* builder){
+    free((*builder).element);
+    free((*builder).point_offset);
+    free((*builder).point_count);
+    free((*builder).xy);
+    free((*builder).reference);
+    gdsii_create_builder(builder);
+}
+
+// Append a new element with no points and return its header.
+inline GDSII_ELEMENT* gdsii_create_element(GDSII_BUILDER* builder, uint8_t type){
+    if((*builder).num_elements == (*builder).element_capacity){
+        uint32_t capacity = (*builder).element_capacity ? 2*(*builder).element_capacity : 1024;
+        (*builder).element = (GDSII_ELEMENT*)realloc((*builder).element, capacity*sizeof(GDSII_ELEMENT));
+        (*builder).point_offset = (uint32_t*)realloc((*builder).point_offset, capacity*sizeof(uint32_t));
+        (*builder).point_count = (uint32_t*)realloc((*builder).point_count, capacity*sizeof(uint32_t));
+        (*builder).element_capacity = capacity;
+    }
+    uint32_t i = (*builder).num_elements++;
+    GDSII_ELEMENT* element = &((*builder).element[i]);
+    (*element).type = type;
+    (*element).path_type = 0;
+    (*element).layer = 0;
+    (*element).datatype = 0;
+    (*element).width = 0;
+    (*builder).point_offset[i] = (*builder).num_points;
+    (*builder).point_count[i] = 0;
+    return element;
+}
+
+// Append (count) uninitialized points to the last element and return a
+// pointer to their coordinates.
+inline int32_t* gdsii_create_points(GDSII_BUILDER* builder, uint32_t count){
+    assert((*builder).num_elements > 0);
+    if((*builder).num_points + count > (*builder).point_capacity){
+        uint32_t capacity = (*builder).point_capacity ? 2*(*builder).point_capacity : 4096;
+        while(capacity < (*builder).num_points + count){ capacity *= 2; }
+        (*builder).xy = (int32_t*)realloc((*builder).xy, 2*(size_t)capacity*sizeof(int32_t));
+        (*builder).point_capacity = capacity;
     }
+    int32_t* xy = &((*builder).xy[2*(size_t)(*builder).num_points]);
+    (*builder).num_points += count;
+    (*builder).point_count[(*builder).num_elements-1] += count;
+    return xy;
+}
+
+// Append a reference for the last (SREF or AREF) element and return it.
+inline GDSII_REFERENCE* gdsii_create_reference(GDSII_BUILDER* builder){
+    assert((*builder).num_elements > 0);
+    if((*builder).num_references == (*builder).reference_capacity){
+        uint32_t capacity = (*builder).reference_capacity ? 2*(*builder).reference_capacity : 256;
+        (*builder).reference = (GDSII_REFERENCE*)realloc((*builder).reference, capacity*sizeof(GDSII_REFERENCE));
+        (*builder).reference_capacity = capacity;
+    }
+    GDSII_REFERENCE* reference = &((*builder).reference[(*builder).num_references++]);
+    (*reference).structure = NULL;
+    (*reference).name = NULL;
+    (*reference).element = (*builder).num_elements-1;
+    (*reference).strans = 0;
+    (*reference).columns = 1;
+    (*reference).rows = 1;
+    (*reference).magnification = 1;
+    (*reference).angle = 0;
+    return reference;
+}
+
+// Copy the scratch arrays into (structure) and empty the builder.
+inline void gdsii_finish_structure(GDSII_BUILDER* builder, GDSII_STRUCTURE* structure, GDSII_ARENA* arena){
+    uint32_t num_elements = (*builder).num_elements;
+    uint32_t num_points = (*builder).num_points;
+    (*structure).num_elements = num_elements;
+    (*structure).num_points = num_points;
+    if(num_elements > 0){
+        (*structure).element = (GDSII_ELEMENT*)gdsii_arena_alloc(arena, num_elements*sizeof(GDSII_ELEMENT));
+        (*structure).point_offset = (uint32_t*)gdsii_arena_alloc(arena, num_elements*sizeof(uint32_t));
+        (*structure).point_count = (uint32_t*)gdsii_arena_alloc(arena, num_elements*sizeof(uint32_t));
+        memcpy((*structure).element, (*builder).element, num_elements*sizeof(GDSII_ELEMENT));
+        memcpy((*structure).point_offset, (*builder).point_offset, num_elements*sizeof(uint32_t));
+        memcpy((*structure).point_count, (*builder).point_count, num_elements*sizeof(uint32_t));
+    }
+    if(num_points > 0){
+        (*structure).xy = (int32_t*)gdsii_arena_alloc(arena, 2*(size_t)num_points*sizeof(int32_t));
+        memcpy((*structure).xy, (*builder).xy, 2*(size_t)num_points*sizeof(int32_t));
+    }
+    uint32_t num_references = (*builder).num_references;
+    (*structure).num_references = num_references;
+    if(num_references > 0){
+        (*structure).reference = (GDSII_REFERENCE*)gdsii_arena_alloc(arena, num_references*sizeof(GDSII_REFERENCE));
+        memcpy((*structure).reference, (*builder).reference, num_references*sizeof(GDSII_REFERENCE));
+    }
+    (*builder).num_elements = 0;
+    (*builder).num_points = 0;
+    (*builder).num_references = 0;
+}
+
+// Coordinates of the points of element (i) of a structure.
+inline const int32_t* gdsii_element_xy(const GDSII_STRUCTURE* structure, uint32_t i){
+    return &((*structure).xy[2*(size_t)(*structure).point_offset[i]]);
 }
 
 inline GDSII* gdsii_create_gdsii(){
     GDSII* gdsii;
     gdsii = (GDSII*)malloc(sizeof(GDSII));
     (*gdsii).structure = NULL;
+    (*gdsii).num_structures = 0;
+    (*gdsii).table = NULL;
+    (*gdsii).table_size = 0;
+    (*gdsii).order = NULL;
+    gdsii_create_arena(&((*gdsii).arena));
     return gdsii;
 }
 
 inline void gdsii_delete_gdsii(GDSII* gdsii){
-    gdsii_delete_structure((*gdsii).structure);
+    gdsii_delete_arena(&((*gdsii).arena));
     free(gdsii);
 }
 
+// Heap memory reserved by a parsed library (bytes).
+inline size_t gdsii_memory_usage(const GDSII* gdsii){
+    return sizeof(GDSII) + (*gdsii).arena.bytes;
+}
+
+////////// HIERARCHY //////////////////////////////////////////////////////////
+
+inline uint32_t gdsii_hash_name(const char* name){
+    uint32_t hash = 2166136261u; // FNV-1a
+    for(const char* c = name; *c != 0x00; c++){
+        hash = (hash ^ (uint8_t)(*c)) * 16777619u;
+    }
+    return hash;
+}
+
+// Structure with the given name, or NULL. Needs gdsii_link() first.
+inline GDSII_STRUCTURE* gdsii_find_structure(const GDSII* gdsii, const char* name){
+    if((*gdsii).table_size == 0 || name == NULL){ return NULL; }
+    uint32_t mask = (*gdsii).table_size - 1;
+    for(uint32_t i = gdsii_hash_name(name) & mask; ; i = (i+1) & mask){ // linear probing
+        GDSII_STRUCTURE* structure = (*gdsii).table[i];
+        if(structure == NULL){ return NULL; }
+        if(strcmp((*structure).name, name) == 0){ return structure; }
+    }
+}
+
+// Build the structure name table, resolve every reference by name, count
+// the parents of each structure, and cut any reference that would make the
+// hierarchy cyclic (which is invalid GDSII, but would never finish drawing).
+inline void gdsii_link(GDSII* gdsii){
+
+    uint32_t num_structures = 0;
+    for(GDSII_STRUCTURE* structure = (*gdsii).structure; structure != NULL; structure = (*structure).next){
+        (*structure).index = num_structures++;
+        (*structure).num_parents = 0;
+    }
+    (*gdsii).num_structures = num_structures;
+
+    // hash table at most half full
+    uint32_t table_size = 16;
+    while(table_size < 2*num_structures){ table_size *= 2; }
+    (*gdsii).table = (GDSII_STRUCTURE**)gdsii_arena_alloc(&((*gdsii).arena), table_size*sizeof(GDSII_STRUCTURE*));
+    memset((*gdsii).table, 0, table_size*sizeof(GDSII_STRUCTURE*));
+    (*gdsii).table_size = table_size;
+    for(GDSII_STRUCTURE* structure = (*gdsii).structure; structure != NULL; structure = (*structure).next){
+        if((*structure).name == NULL){ continue; }
+        uint32_t i = gdsii_hash_name((*structure).name) & (table_size-1);
+        while((*gdsii).table[i] != NULL && strcmp((*(*gdsii).table[i]).name, (*structure).name) != 0){
+            i = (i+1) & (table_size-1);
+        }
+        if((*gdsii).table[i] == NULL){ (*gdsii).table[i] = structure; } // first of duplicate names wins
+    }
+
+    for(GDSII_STRUCTURE* structure = (*gdsii).structure; structure != NULL; structure = (*structure).next){
+        for(uint32_t i=0; i<(*structure).num_references; i++){
+            GDSII_REFERENCE* reference = &((*structure).reference[i]);
+            (*reference).structure = gdsii_find_structure(gdsii, (*reference).name);
+            if((*reference).structure == NULL){
+                fprintf(stderr, "Warning! GDSII structure %s not found.\n", (*reference).name ? (*reference).name : "(unnamed)");
+            }
+        }
+    }
+
+    // depth-first search for cycles (0 = unvisited, 1 = on stack, 2 = done),
+    // which also sorts the structures bottom-up
+    (*gdsii).order = (GDSII_STRUCTURE**)gdsii_arena_alloc(&((*gdsii).arena), (num_structures+1)*sizeof(GDSII_STRUCTURE*));
+    uint32_t num_ordered = 0;
+    std::vector<uint8_t> state(num_structures, 0);
+    std::vector<std::pair<GDSII_STRUCTURE*, uint32_t>> stack; // (structure, next reference)
+    for(GDSII_STRUCTURE* root = (*gdsii).structure; root != NULL; root = (*root).next){
+        if(state[(*root).index] != 0){ continue; }
+        state[(*root).index] = 1;
+        stack.push_back(std::make_pair(root, 0));
+        while(!stack.empty()){
+            GDSII_STRUCTURE* structure = stack.back().first;
+            uint32_t i = stack.back().second++;
+            if(i == (*structure).num_references){
+                state[(*structure).index] = 2;
+                (*gdsii).order[num_ordered++] = structure;
+                stack.pop_back();
+                continue;
+            }
+            GDSII_REFERENCE* reference = &((*structure).reference[i]);
+            if((*reference).structure == NULL){ continue; }
+            uint8_t child_state = state[(*(*reference).structure).index];
+            if(child_state == 1){
+                fprintf(stderr, "Warning! GDSII structure %s references itself.\n", (*reference).name);
+                (*reference).structure = NULL;
+            }else if(child_state == 0){
+                state[(*(*reference).structure).index] = 1;
+                stack.push_back(std::make_pair((*reference).structure, 0));
+            }
+        }
+    }
+
+    for(GDSII_STRUCTURE* structure = (*gdsii).structure; structure != NULL; structure = (*structure).next){
+        for(uint32_t i=0; i<(*structure).num_references; i++){
+            if((*structure).reference[i].structure != NULL){
+                (*(*structure).reference[i].structure).num_parents += 1;
+            }
+        }
+    }
+}
+
+struct GDSII_TRANSFORM{     // 2D affine transform of database units
+    REAL64 a, b, c, d;      // x' = a*x + b*y + tx
+    REAL64 tx, ty;          // y' = c*x + d*y + ty
+};
+
+inline GDSII_TRANSFORM gdsii_identity_transform(){
+    GDSII_TRANSFORM transform = {1, 0, 0, 1, 0, 0};
+    return transform;
+}
+
+// (first) applied after (second)
+inline GDSII_TRANSFORM gdsii_compose_transform(const GDSII_TRANSFORM& first, const GDSII_TRANSFORM& second){
+    GDSII_TRANSFORM transform;
+    transform.a = first.a*second.a + first.b*second.c;
+    transform.b = first.a*second.b + first.b*second.d;
+    transform.c = first.c*second.a + first.d*second.c;
+    transform.d = first.c*second.b + first.d*second.d;
+    transform.tx = first.a*second.tx + first.b*second.ty + first.tx;
+    transform.ty = first.c*second.tx + first.d*second.ty + first.ty;
+    return transform;
+}
+
+// Transform from the referenced structure into (structure) for one
+// instance (column, row) of a reference: reflect, magnify, rotate, then
+// translate. Absolute magnification and angle are treated as relative.
+inline GDSII_TRANSFORM gdsii_reference_transform(const GDSII_STRUCTURE* structure, const GDSII_REFERENCE* reference,
+                                                 uint16_t column = 0, uint16_t row = 0){
+    const int32_t* xy = gdsii_element_xy(structure, (*reference).element);
+    REAL64 radians = (*reference).angle * M_PI / 180.0;
+    REAL64 cosine = cos(radians) * (*reference).magnification;
+    REAL64 sine = sin(radians) * (*reference).magnification;
+    REAL64 flip = ((*reference).strans & STRANS_REFLECT) ? -1 : 1;
+    GDSII_TRANSFORM transform = {cosine, -sine*flip, sine, cosine*flip, (REAL64)xy[0], (REAL64)xy[1]};
+    if((*structure).point_count[(*reference).element] >= 3 && (column > 0 || row > 0)){
+        // AREF: column and row corners are displaced by all columns and rows
+        transform.tx += column * (REAL64)(xy[2]-xy[0]) / (*reference).columns
+                      + row * (REAL64)(xy[4]-xy[0]) / (*reference).rows;
+        transform.ty += column * (REAL64)(xy[3]-xy[1]) / (*reference).columns
+                      + row * (REAL64)(xy[5]-xy[1]) / (*reference).rows;
+    }
+    return transform;
+}
+
+// Call visit(structure, transform) for (structure) and, if it returns true,
+// recursively for every instance it places, with transforms into the
+// coordinates of the first (structure). The hierarchy itself is never
+// flattened in memory.
+template<typename VISITOR>
+inline void gdsii_visit_instances(const GDSII_STRUCTURE* structure, const GDSII_TRANSFORM& transform, VISITOR& visit){
+    if(!visit(structure, transform)){ return; }
+    for(uint32_t i=0; i<(*structure).num_references; i++){
+        const GDSII_REFERENCE* reference = &((*structure).reference[i]);
+        if((*reference).structure == NULL || (*structure).point_count[(*reference).element] < 1){ continue; }
+        uint16_t columns = (*reference).columns, rows = (*reference).rows;
+        if((*structure).element[(*reference).element].type != ELEMENT_TYPE_AREF ||
+           (*structure).point_count[(*reference).element] < 3){
+            columns = 1; rows = 1;
+        }
+        for(uint16_t column=0; column<columns; column++){
+            for(uint16_t row=0; row<rows; row++){
+                GDSII_TRANSFORM child = gdsii_reference_transform(structure, reference, column, row);
+                gdsii_visit_instances((*reference).structure, gdsii_compose_transform(transform, child), visit);
+            }
+        }
+    }
+}
+
+// Visit every instance of every structure placed by the top structures
+// (those that no other structure references).
+template<typename VISITOR>
+inline void gdsii_visit_instances(const GDSII* gdsii, VISITOR visit){
+    for(const GDSII_STRUCTURE* structure = (*gdsii).structure; structure != NULL; structure = (*structure).next){
+        if((*structure).num_parents == 0){
+            gdsii_visit_instances(structure, gdsii_identity_transform(), visit);
+        }
+    }
+}
+
+// A lattice of (columns) x (rows) copies, displaced by (column) and (row)
+// from one to the next, as placed by an AREF.
+struct GDSII_LATTICE{
+    REAL64 column[2];       // displacement between columns (x, y)
+    REAL64 row[2];          // displacement between rows (x, y)
+    uint16_t columns, rows;
+};
+
+// Like gdsii_visit_instances(), but call visit(structure, transform, lattice)
+// once for a whole lattice of instances placed by an AREF rather than once
+// for each instance: (transform) places the first instance, and the others
+// are displaced along (lattice) (in the coordinates of the first
+// structure). An AREF within a lattice is expanded, since a lattice of
+// lattices is not a lattice.
+template<typename VISITOR>
+inline void gdsii_visit_lattices(const GDSII_STRUCTURE* structure, const GDSII_TRANSFORM& transform,
+                                 const GDSII_LATTICE& lattice, VISITOR& visit){
+    if(!visit(structure, transform, lattice)){ return; }
+    for(uint32_t i=0; i<(*structure).num_references; i++){
+        const GDSII_REFERENCE* reference = &((*structure).reference[i]);
+        if((*reference).structure == NULL || (*structure).point_count[(*reference).element] < 1){ continue; }
+        uint16_t columns = (*reference).columns, rows = (*reference).rows;
+        if((*structure).element[(*reference).element].type != ELEMENT_TYPE_AREF ||
+           (*structure).point_count[(*reference).element] < 3){
+            columns = 1; rows = 1;
+        }
+        if(columns*rows > 1 && lattice.columns*lattice.rows == 1){
+            GDSII_TRANSFORM first = gdsii_compose_transform(transform, gdsii_reference_transform(structure, reference));
+            const int32_t* xy = gdsii_element_xy(structure, (*reference).element);
+            REAL64 column[2] = {(REAL64)(xy[2]-xy[0]) / columns, (REAL64)(xy[3]-xy[1]) / columns};
+            REAL64 row[2] = {(REAL64)(xy[4]-xy[0]) / rows, (REAL64)(xy[5]-xy[1]) / rows};
+            GDSII_LATTICE array;
+            array.column[0] = transform.a*column[0] + transform.b*column[1];
+            array.column[1] = transform.c*column[0] + transform.d*column[1];
+            array.row[0] = transform.a*row[0] + transform.b*row[1];
+            array.row[1] = transform.c*row[0] + transform.d*row[1];
+            array.columns = columns;
+            array.rows = rows;
+            gdsii_visit_lattices((*reference).structure, first, array, visit);
+            continue;
+        }
+        for(uint16_t column=0; column<columns; column++){
+            for(uint16_t row=0; row<rows; row++){
+                GDSII_TRANSFORM child = gdsii_reference_transform(structure, reference, column, row);
+                gdsii_visit_lattices((*reference).structure, gdsii_compose_transform(transform, child), lattice, visit);
+            }
+        }
+    }
+}
+
+// Visit every lattice of instances placed by the top structures.
+template<typename VISITOR>
+inline void gdsii_visit_lattices(const GDSII* gdsii, VISITOR visit){
+    GDSII_LATTICE single = {{0, 0}, {0, 0}, 1, 1};
+    for(const GDSII_STRUCTURE* structure = (*gdsii).structure; structure != NULL; structure = (*structure).next){
+        if((*structure).num_parents == 0){
+            gdsii_visit_lattices(structure, gdsii_identity_transform(), single, visit);
+        }
+    }
+}
+
+////////// LAYER INDEX ////////////////////////////////////////////////////////
+
+// Boundaries of a library on one layer, found in a single pass over all
+// elements for every requested layer at once, so that drawing a layer only
+// touches its own elements and the structures that (eventually) place them.
+struct GDSII_LAYER{                 // index of boundaries on one layer
+    int16_t layer;                  // GDSII layer number
+    int16_t datatype;               // GDSII datatype number (-1 for any)
+    std::vector<uint32_t> start;    // boundaries of structure (i) are element[start[i]] ... element[start[i+1]-1]
+    std::vector<uint32_t> element;  // element indices, grouped by structure
+    std::vector<uint8_t> used;      // whether structure (i) has or places any boundaries
+};
+
+// Fill in (layers), whose layer and datatype numbers are already set.
+// KLayout PCELL structures ("$$$CONTEXT_INFO$$$") are left out.
+inline void gdsii_index_layers(const GDSII* gdsii, std::vector<GDSII_LAYER>& layers){
+
+    uint32_t num_structures = (*gdsii).num_structures;
+    std::vector<std::pair<int16_t, uint32_t>> by_layer; // (layer number, index into (layers)), sorted
+    for(uint32_t i=0; i<layers.size(); i++){
+        by_layer.push_back(std::make_pair(layers[i].layer, i));
+        layers[i].start.assign(num_structures+1, 0);
+        layers[i].element.clear();
+        layers[i].used.assign(num_structures, 0);
+    }
+    std::sort(by_layer.begin(), by_layer.end());
+
+    for(const GDSII_STRUCTURE* structure = (*gdsii).structure; structure != NULL; structure = (*structure).next){
+        uint32_t s = (*structure).index;
+        for(uint32_t i=0; i<layers.size(); i++){
+            layers[i].start[s] = layers[i].element.size();
+        }
+        if((*structure).name != NULL && strcmp((*structure).name, "$$$CONTEXT_INFO$$$") == 0){ continue; }
+        for(uint32_t e=0; e<(*structure).num_elements; e++){
+            const GDSII_ELEMENT& element = (*structure).element[e];
+            if(element.type != ELEMENT_TYPE_BOUNDARY){ continue; }
+            std::vector<std::pair<int16_t, uint32_t>>::const_iterator match =
+                std::lower_bound(by_layer.begin(), by_layer.end(), std::make_pair(element.layer, (uint32_t)0));
+            for(; match != by_layer.end() && match->first == element.layer; match++){
+                GDSII_LAYER& layer = layers[match->second];
+                if(layer.datatype < 0 || layer.datatype == element.datatype){
+                    layer.element.push_back(e);
+                }
+            }
+        }
+    }
+
+    // propagate use bottom-up through the hierarchy
+    for(uint32_t i=0; i<layers.size(); i++){
+        GDSII_LAYER& layer = layers[i];
+        layer.start[num_structures] = layer.element.size();
+        for(uint32_t j=0; j<num_structures; j++){
+            const GDSII_STRUCTURE* structure = (*gdsii).order[j];
+            uint32_t s = (*structure).index;
+            bool used = layer.start[s+1] > layer.start[s];
+            for(uint32_t r=0; r<(*structure).num_references && !used; r++){
+                const GDSII_STRUCTURE* child = (*structure).reference[r].structure;
+                used = (child != NULL) && layer.used[(*child).index];
+            }
+            if((*structure).name != NULL && strcmp((*structure).name, "$$$CONTEXT_INFO$$$") == 0){ used = false; }
+            layer.used[s] = used;
+        }
+    }
+}
+
 ////////// DATA PARSING ///////////////////////////////////////////////////////
 
-inline std::vector<int16_t> gdsii_parse_int16(uint8_t* data, uint16_t length){
+// single big-endian numbers
+inline int16_t gdsii_int16(const uint8_t* data){
+    return (int16_t)(((uint16_t)data[0] << 8) | (uint16_t)data[1]);
+}
+
+inline int32_t gdsii_int32(const uint8_t* data){
+    return (int32_t)(((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+                     ((uint32_t)data[2] << 8) | (uint32_t)data[3]);
+}
+
+inline std::vector<int16_t> gdsii_parse_int16(const uint8_t* data, uint16_t length){
     assert(length%2==0);
     std::vector<int16_t> numbers;
     for(unsigned int i=0; i<length/2; i++){
-        numbers.push_back((data[2*i+0] << 8) + data[2*i+1]);
+        numbers.push_back(gdsii_int16(&data[2*i]));
     }
     return numbers;
 }
 
-inline std::vector<int32_t> gdsii_parse_int32(uint8_t* data, uint16_t length){
+inline std::vector<int32_t> gdsii_parse_int32(const uint8_t* data, uint16_t length){
     assert(length%4==0);
     std::vector<int32_t> numbers;
     for(unsigned int i=0; i<length/4; i++){
-        int32_t num = (data[4*i+0] << 24) + (data[4*i+1] << 16) + (data[4*i+2] << 8) + data[4*i+3];
-        numbers.push_back(num);
+        numbers.push_back(gdsii_int32(&data[4*i]));
     }
     return numbers;
 }
 
-/*
- * NOT IEEE754!
-std::vector<REAL32> parse_real32(uint8_t* data, uint16_t length){
+// GDSII reals are NOT IEEE754! They are a sign bit, a 7-bit excess-64
+// base-16 exponent, and a 56-bit mantissa without hidden bit (REAL64), i.e.,
+// (-1)^sign * (mantissa/2^56) * 16^(exponent-64). GDSII REAL32 (the same
+// with a 24-bit mantissa) is not used by any record read here.
+inline REAL64 gdsii_real64(const uint8_t* data){
+    uint64_t mantissa = 0;
+    for(unsigned int i=1; i<8; i++){
+        mantissa = (mantissa << 8) | data[i];
+    }
+    int exponent = (data[0] & 0x7f) - 64;
+    REAL64 value = ldexp((REAL64)mantissa, 4*exponent - 56);
+    return (data[0] & 0x80) ? -value : value;
 }
-std::vector<REAL64> parse_real64(uint8_t* data, uint16_t length){
+
+inline std::vector<REAL64> gdsii_parse_real64(const uint8_t* data, uint16_t length){
     assert(length%8==0);
-    std::vector<REAL64> newdata;
-    for(uint i=0; i<length/8; i++){
-        int sign = 1;
-        if(data[0]&0x80) sign=-1;
-        // TODO: finish this
-        //newdata.push_back((data[4*i] << 3) + (data[4*i+1] << 2) + (data[4*i+2] << 1) + data[4*i+3]);
+    std::vector<REAL64> numbers;
+    for(unsigned int i=0; i<length/8; i++){
+        numbers.push_back(gdsii_real64(&data[8*i]));
     }
-    return newdata;
+    return numbers;
 }
-*/
 
-inline char* gdsii_parse_string(uint8_t* data, uint16_t length){
+inline char* gdsii_parse_string(const uint8_t* data, uint16_t length, GDSII_ARENA* arena){
     // data is not necessarily null-terminated
     char* text = NULL;
-    text = (char*)malloc(sizeof(char)*(length+1));
+    text = (char*)gdsii_arena_alloc(arena, sizeof(char)*(length+1));
     for(unsigned int i=0; i<length; i++){
         text[i] = data[i];
     }
@@ -252,16 +783,318 @@ inline char* gdsii_parse_string(uint8_t* data, uint16_t length){
     return text;
 }
 
+////////// RECORD READING /////////////////////////////////////////////////////
+
+const uint8_t GDSII_READER_STREAM = 0x00; // fread each record into a new buffer
+const uint8_t GDSII_READER_MAPPED = 0x01; // map whole file, borrow records in place
+const uint8_t GDSII_READER_PARALLEL = 0x02; // map whole file, parse structures on all cores
+
+struct GDSII_RECORD{        // a single record of a GDSII file
+    uint16_t length;        // length of data, not entire record
+    uint8_t record_type;    // type of record
+    uint8_t data_type;      // type of data in record
+    const uint8_t* data;    // record data (borrowed, not owned by the record)
+};
+
+struct GDSII_READ_STATS{    // reader throughput, to compare reader modes
+    uint64_t bytes;         // number of bytes read
+    uint64_t records;       // number of records read
+    double seconds;         // wall clock time spent reading and parsing
+};
+
+struct GDSII_FILE_MAP{      // a read-only memory map of an entire file
+    const uint8_t* data;    // start of mapped file
+    size_t size;            // size of mapped file (bytes)
+#ifdef _WIN32
+    HANDLE file;            // (to close map later)
+    HANDLE mapping;
+#endif
+};
+
+inline bool gdsii_map_file(GDSII_FILE_MAP* map, const char* filepath){
+    (*map).data = NULL;
+    (*map).size = 0;
+#ifdef _WIN32
+    (*map).file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if((*map).file == INVALID_HANDLE_VALUE){ return false; }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx((*map).file, &size) || size.QuadPart == 0){
+        CloseHandle((*map).file);
+        return false;
+    }
+    (*map).mapping = CreateFileMappingA((*map).file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if((*map).mapping == NULL){ CloseHandle((*map).file); return false; }
+    (*map).data = (const uint8_t*)MapViewOfFile((*map).mapping, FILE_MAP_READ, 0, 0, 0);
+    if((*map).data == NULL){
+        CloseHandle((*map).mapping);
+        CloseHandle((*map).file);
+        return false;
+    }
+    (*map).size = (size_t)size.QuadPart;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if(fd < 0){ return false; }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0){ close(fd); return false; }
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // map stays valid after file is closed
+    if(data == MAP_FAILED){ return false; }
+    madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL); // only a hint; ignore failure
+    (*map).data = (const uint8_t*)data;
+    (*map).size = (size_t)info.st_size;
+#endif
+    return true;
+}
+
+inline void gdsii_unmap_file(GDSII_FILE_MAP* map){
+    if((*map).data == NULL){ return; }
+#ifdef _WIN32
+    UnmapViewOfFile((*map).data);
+    CloseHandle((*map).mapping);
+    CloseHandle((*map).file);
+#else
+    munmap((void*)(*map).data, (*map).size);
+#endif
+    (*map).data = NULL;
+    (*map).size = 0;
+}
+
+// Read the record at (*cursor) in place and advance (*cursor) past it.
+// Returns false at the end of the data or at a malformed record (e.g., the
+// zero padding many tools write after ENDLIB).
+inline bool gdsii_next_record(const uint8_t** cursor, const uint8_t* end, GDSII_RECORD* record){
+    const uint8_t* header = *cursor;
+    if(end - header < 4){ return false; } // header is always 32 bits long
+    uint16_t total = (header[0] << 8) + header[1]; // length of entire record
+    if(total < 4 || total > end - header){ return false; }
+    (*record).length = total - 4;
+    (*record).record_type = header[2];
+    (*record).data_type = header[3];
+    (*record).data = header + 4;
+    *cursor = header + total;
+    return true;
+}
+
 ////////// DATA PARSING ///////////////////////////////////////////////////////
 
-inline bool gdsii_read(GDSII* gdsii, const char* filepath){
+// Layers to read. Boundaries, paths, and boxes on any other layer are
+// dropped as soon as their LAYER (or DATATYPE) record is read, so their
+// coordinates are never decoded or stored.
+struct GDSII_FILTER{
+    std::vector<uint8_t> layer;     // for each layer number: 0 = skip, 1 = all datatypes, 2 = only listed datatypes
+    std::vector<std::pair<int16_t, int16_t>> datatype; // listed (layer, datatype) pairs
+};
+
+inline void gdsii_create_filter(GDSII_FILTER* filter){
+    (*filter).layer.assign(1 << 16, 0);
+    (*filter).datatype.clear();
+}
+
+// Read (layer), with only the given (datatype), or all datatypes if negative.
+inline void gdsii_filter_add(GDSII_FILTER* filter, int16_t layer, int16_t datatype){
+    uint8_t& mode = (*filter).layer[(uint16_t)layer];
+    if(datatype < 0){
+        mode = 1;
+    }else if(mode != 1){
+        mode = 2;
+        (*filter).datatype.push_back(std::make_pair(layer, datatype));
+    }
+}
+
+inline bool gdsii_filter_layer(const GDSII_FILTER* filter, int16_t layer){
+    return (*filter).layer[(uint16_t)layer] != 0;
+}
+
+inline bool gdsii_filter_datatype(const GDSII_FILTER* filter, int16_t layer, int16_t datatype){
+    uint8_t mode = (*filter).layer[(uint16_t)layer];
+    if(mode != 2){ return mode == 1; }
+    for(unsigned int i=0; i<(*filter).datatype.size(); i++){
+        if((*filter).datatype[i].first == layer && (*filter).datatype[i].second == datatype){ return true; }
+    }
+    return false;
+}
+
+struct GDSII_PARSER{                // parsing state between records
+    GDSII_ARENA* arena;             // memory of library being read into
+    GDSII_STRUCTURE** next;         // end of structure linked list
+    GDSII_STRUCTURE* structure;     // structure being read (or NULL)
+    GDSII_BUILDER builder;          // elements of structure being read
+    bool in_element;                // whether last element is still being read
+    const GDSII_FILTER* filter;     // layers to read (or NULL for all)
+};
+
+// Parsed structures are linked at (*next) and allocated from (arena).
+inline void gdsii_create_parser(GDSII_PARSER* parser, GDSII_STRUCTURE** next, GDSII_ARENA* arena,
+                                const GDSII_FILTER* filter = NULL){
+    (*parser).filter = filter;
+    (*parser).arena = arena;
+    (*parser).next = next;
+    (*parser).structure = NULL;
+    gdsii_create_builder(&((*parser).builder));
+    (*parser).in_element = false;
+}
+
+// Keep any structure left unfinished by a truncated file, and free scratch memory.
+inline void gdsii_delete_parser(GDSII_PARSER* parser){
+    if((*parser).structure != NULL){
+        gdsii_finish_structure(&((*parser).builder), (*parser).structure, (*parser).arena);
+        (*parser).structure = NULL;
+    }
+    gdsii_delete_builder(&((*parser).builder));
+}
+
+// Forget the last element and ignore its records until the next element.
+inline void gdsii_drop_element(GDSII_PARSER* parser){
+    GDSII_BUILDER* builder = &((*parser).builder);
+    uint32_t i = (*builder).num_elements-1;
+    (*builder).num_points -= (*builder).point_count[i];
+    (*builder).num_elements -= 1;
+    (*parser).in_element = false;
+}
+
+inline void gdsii_parse_record(GDSII_PARSER* parser, const GDSII_RECORD* record){
+
+    const uint8_t* data = (*record).data;
+    uint16_t length = (*record).length;
+    uint8_t data_type = (*record).data_type;
+    GDSII_STRUCTURE* structure = (*parser).structure;
+    GDSII_BUILDER* builder = &((*parser).builder);
+    GDSII_ARENA* arena = (*parser).arena;
+    //std::cout << "RECORD: length: " << (int)(length+4) << " type: " << (int)(*record).record_type << " data: " << (int)data_type << std::endl;
+
+    // element records outside of a structure are malformed; ignore them
+    uint8_t element_type = ELEMENT_TYPE_UNKNOWN;
+    switch((*record).record_type){
+        case RECORD_TYPE_BOUNDARY: element_type = ELEMENT_TYPE_BOUNDARY; break;
+        case RECORD_TYPE_PATH: element_type = ELEMENT_TYPE_PATH; break;
+        case RECORD_TYPE_SREF: element_type = ELEMENT_TYPE_SREF; break;
+        case RECORD_TYPE_AREF: element_type = ELEMENT_TYPE_AREF; break;
+        case RECORD_TYPE_BOX: element_type = ELEMENT_TYPE_BOX; break;
+    }
+    if(element_type != ELEMENT_TYPE_UNKNOWN){
+        //printf("\tELEMENT\n"); fflush(stdout);
+        if(structure == NULL){ return; }
+        gdsii_create_element(builder, element_type);
+        if(element_type == ELEMENT_TYPE_SREF || element_type == ELEMENT_TYPE_AREF){
+            gdsii_create_reference(builder);
+        }
+        (*parser).in_element = true;
+        return;
+    }
+
+    // reference of current element (if it is an SREF or AREF)
+    GDSII_REFERENCE* reference = NULL;
+    if((*parser).in_element && (*builder).num_references > 0 &&
+       (*builder).reference[(*builder).num_references-1].element == (*builder).num_elements-1){
+        reference = &((*builder).reference[(*builder).num_references-1]);
+    }
+
+    switch((*record).record_type){
+        case RECORD_TYPE_UNITS:
+            //printf("UNITS\n"); fflush(stdout);
+            //std::cout << (int)data_type << std::endl;
+            break;
+        case RECORD_TYPE_BGNSTR: // create new structure
+            //printf("STRUCTURE\n"); fflush(stdout);
+            if(structure != NULL){ // (missing ENDSTR)
+                gdsii_finish_structure(builder, structure, arena);
+                (*parser).next = &((*structure).next);
+            }
+            structure = gdsii_create_structure(arena);
+            (*(*parser).next) = structure;
+            (*parser).structure = structure;
+            break;
+        case RECORD_TYPE_ENDSTR: // move marker to new end of linked list
+            // TODO
+            // layers named "$$$CONTEXT_INFO$$$ may be used to store additional data (PCell?) (https://www.klayout.de/forum/discussion/1026/very-important-gds-exported-from-k-layout-not-working-on-cadence-at-foundry)
+            //printf("ENDSTRUCT\n"); fflush(stdout);
+            if(structure == NULL){ break; }
+            gdsii_finish_structure(builder, structure, arena);
+            (*parser).next = &((*structure).next);
+            (*parser).structure = NULL;
+            (*parser).in_element = false;
+            break;
+        case RECORD_TYPE_STRNAME: // assume data is null-terminated
+            if(structure == NULL){ break; }
+            (*structure).name = gdsii_parse_string(data, length, arena);
+            //std::cout << (*structure).name << std::endl;
+            break;
+        case RECORD_TYPE_ENDEL: // end element
+            //printf("\tENDEL\n"); fflush(stdout);
+            (*parser).in_element = false;
+            break;
+        case RECORD_TYPE_XY:
+            //printf("\t\tXY\n"); fflush(stdout);
+            if((*parser).in_element && data_type == DATA_TYPE_INT32 && length%8 == 0){ // (whole x, y pairs only)
+                int32_t* xy = gdsii_create_points(builder, length/8);
+                for(unsigned int i=0; i<2*(length/8); i++){
+                    xy[i] = gdsii_int32(&data[4*i]);
+                }
+            }
+            break;
+        case RECORD_TYPE_LAYER:
+            //printf("\t\tLAYER\n"); fflush(stdout);
+            if((*parser).in_element && data_type == DATA_TYPE_INT16 && length >= 2){
+                GDSII_ELEMENT* element = &((*builder).element[(*builder).num_elements-1]);
+                (*element).layer = gdsii_int16(data);
+                if((*parser).filter != NULL && reference == NULL &&
+                   !gdsii_filter_layer((*parser).filter, (*element).layer)){
+                    gdsii_drop_element(parser);
+                }
+            }
+            break;
+        case RECORD_TYPE_DATATYPE:
+            if((*parser).in_element && data_type == DATA_TYPE_INT16 && length >= 2){
+                GDSII_ELEMENT* element = &((*builder).element[(*builder).num_elements-1]);
+                (*element).datatype = gdsii_int16(data);
+                if((*parser).filter != NULL && reference == NULL &&
+                   !gdsii_filter_datatype((*parser).filter, (*element).layer, (*element).datatype)){
+                    gdsii_drop_element(parser);
+                }
+            }
+            break;
+        case RECORD_TYPE_SNAME:
+            if(reference != NULL && data_type == DATA_TYPE_ASCII){
+                (*reference).name = gdsii_parse_string(data, length, arena);
+            }
+            break;
+        case RECORD_TYPE_STRANS:
+            if(reference != NULL && data_type == DATA_TYPE_BITARRAY && length >= 2){
+                (*reference).strans = (uint16_t)gdsii_int16(data);
+            }
+            break;
+        case RECORD_TYPE_MAG:
+            if(reference != NULL && data_type == DATA_TYPE_REAL64 && length >= 8){
+                (*reference).magnification = gdsii_real64(data);
+            }
+            break;
+        case RECORD_TYPE_ANGLE:
+            if(reference != NULL && data_type == DATA_TYPE_REAL64 && length >= 8){
+                (*reference).angle = gdsii_real64(data);
+            }
+            break;
+        case RECORD_TYPE_COLROW:
+            if(reference != NULL && data_type == DATA_TYPE_INT16 && length >= 4){
+                int16_t columns = gdsii_int16(&data[0]);
+                int16_t rows = gdsii_int16(&data[2]);
+                (*reference).columns = columns > 0 ? columns : 1;
+                (*reference).rows = rows > 0 ? rows : 1;
+            }
+            break;
+    }
+}
+
+// Original reader: one fread for each record header and one buffer
+// allocation and fread for each record body.
+inline bool gdsii_read_stream(GDSII* gdsii, const char* filepath, GDSII_READ_STATS* stats,
+                              const GDSII_FILTER* filter = NULL){
 
     FILE* file = fopen(filepath, "rb");
     if(file == NULL){ perror("Error! Could not read GDS file."); return false; }
 
-    // end of structure linked list
-    GDSII_STRUCTURE** structure = &((*gdsii).structure);
-    GDSII_ELEMENT** element = NULL;
+    GDSII_PARSER parser;
+    gdsii_create_parser(&parser, &((*gdsii).structure), &((*gdsii).arena), filter);
 
     while(true){
 
@@ -270,100 +1103,188 @@ inline bool gdsii_read(GDSII* gdsii, const char* filepath){
         uint8_t buffer[4]; // header is always 32 bits long
         size_t read = fread(buffer, sizeof(uint8_t), 4, file);
         //printf("read: %d\n", read); fflush(stdout);
-        if(read==0){ break; } // reached EOF
+        if(read < 4){ break; } // reached EOF
+        uint16_t total = (buffer[0] << 8) + buffer[1];
+        if(total < 4){ break; } // reached padding after ENDLIB
 
         // create new record
-        uint16_t length = (buffer[0] << 8) + buffer[1] - 4; // length of data, not entire record
-        //printf("LENGTH: %d\n", length); fflush(stdout);
-        uint8_t record_type = buffer[2];
-        uint8_t data_type = buffer[3];
-        //std::cout << "RECORD: length: " << (int)(length+4) << " type: " << (int)record_type << " data: " << (int)data_type << std::endl;
+        GDSII_RECORD record;
+        record.length = total - 4; // length of data, not entire record
+        //printf("LENGTH: %d\n", record.length); fflush(stdout);
+        record.record_type = buffer[2];
+        record.data_type = buffer[3];
 
         // read record data
         uint8_t* data = nullptr;
-        if(length > 0){
-            data = new uint8_t[length];
-            fread(data, sizeof(uint8_t), length, file);
+        if(record.length > 0){
+            data = new uint8_t[record.length];
+            if(fread(data, sizeof(uint8_t), record.length, file) < record.length){
+                delete[] data;
+                break; // truncated file
+            }
         }
+        record.data = data;
 
-        switch(record_type){
-            case RECORD_TYPE_UNITS:
-                //printf("UNITS\n"); fflush(stdout);
-                //std::cout << (int)data_type << std::endl;
-                break;
-            case RECORD_TYPE_BGNSTR: // create new structure
-                //printf("STRUCTURE\n"); fflush(stdout);
-                (*structure) = gdsii_create_structure();
-                element = &((**structure).element);
-                break;
-            case RECORD_TYPE_ENDSTR: // move marker to new end of linked list
-                // TODO
-                // layers named "$$$CONTEXT_INFO$$$ may be used to store additional data (PCell?) (https://www.klayout.de/forum/discussion/1026/very-important-gds-exported-from-k-layout-not-working-on-cadence-at-foundry)
-                //printf("ENDSTRUCT\n"); fflush(stdout);
-                structure = &((**structure).next);
-                break;
-            case RECORD_TYPE_STRNAME: // assume data is null-terminated
-                (**structure).name = gdsii_parse_string(data, length);
-                //std::cout << (**structure).name << std::endl;
-                break;
-            case RECORD_TYPE_ENDEL: // end element
-                //printf("\tENDEL\n"); fflush(stdout);
-                element = &((**element).next);
-                break;
-            case RECORD_TYPE_BOUNDARY:
-                //printf("\tBOUNDARY\n"); fflush(stdout);
-                (*element) = gdsii_create_element();
-                (**element).type = ELEMENT_TYPE_BOUNDARY;
-                break;
-            case RECORD_TYPE_PATH:
-                //printf("\tPATH\n"); fflush(stdout);
-                (*element) = gdsii_create_element();
-                (**element).type = ELEMENT_TYPE_PATH;
-                break;
-            case RECORD_TYPE_SREF:
-                //printf("\tSREF\n"); fflush(stdout);
-                (*element) = gdsii_create_element();
-                (**element).type = ELEMENT_TYPE_SREF;
-                break;
-            case RECORD_TYPE_AREF:
-                //printf("\tAREF\n"); fflush(stdout);
-                (*element) = gdsii_create_element();
-                (**element).type = ELEMENT_TYPE_AREF;
-                break;
-            case RECORD_TYPE_BOX:
-                //printf("\tBOX\n"); fflush(stdout);
-                (*element) = gdsii_create_element();
-                (**element).type = ELEMENT_TYPE_BOX;
-                break;
-            case RECORD_TYPE_XY:
-                //printf("\t\tXY\n"); fflush(stdout);
-                if(data_type == DATA_TYPE_INT32){
-                    GDSII_POINT** point = &((**element).point);
-                    std::vector<int32_t>coordinates = gdsii_parse_int32(data, length);
-                    assert(coordinates.size()%2==0);
-                    for(unsigned int i=0; i<coordinates.size()/2; i++){
-                        (*point) = gdsii_create_point();
-                        (**point).x = (REAL64) coordinates[i*2+0];
-                        (**point).y = (REAL64) coordinates[i*2+1];
-                        point = &((**point).next);
-                    }
-                }
-                break;
-            case RECORD_TYPE_LAYER:
-                //printf("\t\tLAYER\n"); fflush(stdout);
-                if(data_type == DATA_TYPE_INT16){
-                    std::vector<int16_t>points = gdsii_parse_int16(data, length);
-                    (**element).layer = points[0];
-                }
-                break;
-        }
+        gdsii_parse_record(&parser, &record);
+        (*stats).bytes += total;
+        (*stats).records += 1;
 
         delete[] data;
+        if(record.record_type == RECORD_TYPE_ENDLIB){ break; }
     }
 
     fclose(file);
+    gdsii_delete_parser(&parser);
+
+    return true;
+}
+
+// Memory-mapped reader: walk record headers in place and hand the parser
+// spans of the mapped file, so there is no per-record syscall or copy.
+inline bool gdsii_read_mapped(GDSII* gdsii, const char* filepath, GDSII_READ_STATS* stats,
+                              const GDSII_FILTER* filter = NULL){
+
+    GDSII_FILE_MAP map;
+    if(!gdsii_map_file(&map, filepath)){ perror("Error! Could not map GDS file."); return false; }
+
+    GDSII_PARSER parser;
+    gdsii_create_parser(&parser, &((*gdsii).structure), &((*gdsii).arena), filter);
+
+    const uint8_t* cursor = map.data;
+    const uint8_t* end = map.data + map.size;
+    GDSII_RECORD record;
+    while(gdsii_next_record(&cursor, end, &record)){
+        gdsii_parse_record(&parser, &record);
+        (*stats).records += 1;
+        if(record.record_type == RECORD_TYPE_ENDLIB){ break; }
+    }
+    (*stats).bytes += cursor - map.data;
+
+    gdsii_delete_parser(&parser);
+    gdsii_unmap_file(&map);
 
     return true;
 }
 
+// Parallel reader: a fast first pass over the mapped record headers finds
+// the span of every structure (BGNSTR...ENDSTR); structures are independent,
+// so a pool of threads then parses them concurrently, each thread into its
+// own arena. The structures are linked back together in file order and the
+// thread arenas handed over to the library.
+struct GDSII_SPAN{              // bytes of one structure in a mapped file
+    const uint8_t* begin;       // BGNSTR record
+    const uint8_t* end;         // just past ENDSTR record
+};
+
+inline void gdsii_parse_span(GDSII_PARSER* parser, const GDSII_SPAN* span){
+    const uint8_t* cursor = (*span).begin;
+    GDSII_RECORD record;
+    while(gdsii_next_record(&cursor, (*span).end, &record)){
+        gdsii_parse_record(parser, &record);
+    }
+}
+
+inline bool gdsii_read_parallel(GDSII* gdsii, const char* filepath, GDSII_READ_STATS* stats,
+                                const GDSII_FILTER* filter = NULL, unsigned int num_threads = 0){
+
+    GDSII_FILE_MAP map;
+    if(!gdsii_map_file(&map, filepath)){ perror("Error! Could not map GDS file."); return false; }
+
+    // first pass: find structures; parse library records in place
+    GDSII_PARSER parser;
+    gdsii_create_parser(&parser, &((*gdsii).structure), &((*gdsii).arena), filter);
+    std::vector<GDSII_SPAN> spans;
+    const uint8_t* cursor = map.data;
+    const uint8_t* end = map.data + map.size;
+    const uint8_t* begin = NULL; // start of structure being scanned
+    GDSII_RECORD record;
+    while(true){
+        const uint8_t* start = cursor;
+        if(!gdsii_next_record(&cursor, end, &record)){ break; }
+        (*stats).records += 1;
+        if(record.record_type == RECORD_TYPE_BGNSTR){
+            if(begin != NULL){ spans.push_back({begin, start}); } // (missing ENDSTR)
+            begin = start;
+        }else if(record.record_type == RECORD_TYPE_ENDSTR){
+            if(begin != NULL){ spans.push_back({begin, cursor}); }
+            begin = NULL;
+        }else if(begin == NULL){
+            gdsii_parse_record(&parser, &record);
+            if(record.record_type == RECORD_TYPE_ENDLIB){ break; }
+        }
+    }
+    if(begin != NULL){ spans.push_back({begin, cursor}); } // (truncated file)
+    (*stats).bytes += cursor - map.data;
+
+    // second pass: parse structures concurrently
+    if(num_threads == 0){ num_threads = std::thread::hardware_concurrency(); }
+    if(num_threads == 0){ num_threads = 1; }
+    if(num_threads > spans.size()){ num_threads = spans.size(); }
+    std::vector<GDSII_STRUCTURE*> structures(spans.size(), NULL);
+    std::vector<GDSII_ARENA> arenas(num_threads);
+    std::atomic<size_t> next_span(0);
+    auto work = [&](unsigned int thread){
+        GDSII_ARENA* arena = &arenas[thread];
+        gdsii_create_arena(arena);
+        GDSII_PARSER span_parser;
+        while(true){
+            size_t i = next_span++; // structures differ in size, so take one at a time
+            if(i >= spans.size()){ break; }
+            gdsii_create_parser(&span_parser, &structures[i], arena, filter);
+            gdsii_parse_span(&span_parser, &spans[i]);
+            gdsii_delete_parser(&span_parser);
+        }
+    };
+    std::vector<std::thread> threads;
+    for(unsigned int i=1; i<num_threads; i++){
+        threads.push_back(std::thread(work, i));
+    }
+    if(num_threads > 0){ work(0); }
+    for(unsigned int i=0; i<threads.size(); i++){
+        threads[i].join();
+    }
+
+    // stitch structures together in file order
+    for(size_t i=0; i<structures.size(); i++){
+        if(structures[i] == NULL){ continue; }
+        (*parser.next) = structures[i];
+        parser.next = &((*structures[i]).next);
+    }
+    for(unsigned int i=0; i<num_threads; i++){
+        gdsii_merge_arena(&((*gdsii).arena), &arenas[i]);
+    }
+
+    gdsii_delete_parser(&parser);
+    gdsii_unmap_file(&map);
+
+    return true;
+}
+
+inline bool gdsii_read(GDSII* gdsii, const char* filepath,
+                       uint8_t reader = GDSII_READER_PARALLEL,
+                       GDSII_READ_STATS* stats = NULL,
+                       const GDSII_FILTER* filter = NULL){
+
+    GDSII_READ_STATS local_stats;
+    if(stats == NULL){ stats = &local_stats; }
+    (*stats).bytes = 0;
+    (*stats).records = 0;
+    (*stats).seconds = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool success;
+    if(reader == GDSII_READER_STREAM){
+        success = gdsii_read_stream(gdsii, filepath, stats, filter);
+    }else if(reader == GDSII_READER_MAPPED){
+        success = gdsii_read_mapped(gdsii, filepath, stats, filter);
+    }else{
+        success = gdsii_read_parallel(gdsii, filepath, stats, filter);
+    }
+    gdsii_link(gdsii);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    (*stats).seconds = elapsed.count();
+
+    return success;
+}
+
 #endif
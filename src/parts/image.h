@@ -6,13 +6,15 @@
 #include <QOpenGLBuffer>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
-#include <QMessageBox>
 #include <QFileInfo>
+#include <QDebug>
 #include <QImage>
 
 #include <vector>
 #include "glm/glm.hpp"
 #include "glm/gtc/type_ptr.hpp"
+#include "renderqueue.h"
+#include "shader.h"
 
 class Image : protected QOpenGLFunctions {
 public:
@@ -27,102 +29,98 @@ public:
 
     QOpenGLVertexArrayObject* body_VAO;
     QOpenGLBuffer* body_VBO;
-    QOpenGLShaderProgram* body_shader = nullptr;
+    Shader* body_shader = nullptr; // (owned by Shader registry)
     QOpenGLVertexArrayObject* face_VAO;
     QOpenGLBuffer* face_VBO;
-    QOpenGLShaderProgram* face_shader = nullptr;
-    QImage* image;
+    Shader* face_shader = nullptr;
+    QImage* image = nullptr; // (read by prepare(), until deinitialize() or release())
     QOpenGLTexture* texture;
 
 // this is messy, but easier than separate files
+//
+// Faces are shaded flat by the normal of the plane of their positions in
+// view coordinates (see RenderQueue), so vertices have none.
 const char* vertex_source_body = "                           \n\
-    #version 330 core                                   \n\
+    #version 330 core                                   \n"
+    RENDER_ITEMS_SOURCE "                               \n\
     layout (location = 0) in vec3 pos;                  \n\
-    layout (location = 1) in vec3 nor;                  \n\
-    uniform mat4 transform;                             \n\
-    uniform mat4 rotate;                                \n\
-    out vec4 normal;                                    \n\
+    out vec3 position;                                  \n\
     void main(){                                        \n\
-        gl_Position = transform * vec4(pos.xyz, 1.0f);  \n\
-        normal = rotate * vec4(nor.xyz, 1.0f);          \n\
+        position = (items[item].transform * vec4(pos.xyz, 1.0f)).xyz;\n\
+        gl_Position = projection * vec4(position, 1.0f);\n\
     }";
 const char* fragment_source_body = "                         \n\
-    #version 330 core                                   \n\
-    uniform vec3 color;                                 \n\
-    in vec4 normal;                                     \n\
+    #version 330 core                                   \n"
+    RENDER_ITEMS_SOURCE RENDER_SHADE_SOURCE "           \n\
+    in vec3 position;                                   \n\
     out vec4 FragColor;                                 \n\
     void main(){                                        \n\
-        vec3 light1 = vec3(-0.70, 0.42, 0.58);          \n\
-        float diff1 = max(dot(light1, normal.xyz), 0.0);\n\
-        vec3 light2 = vec3(0.70, -0.42, -0.58);         \n\
-        float diff2 = max(dot(light2, normal.xyz), 0.0);\n\
-        float ambient = 0.1;                            \n\
-        vec3 final = (ambient+2*(diff1+diff2*0.5))*color;\n\
-        FragColor = vec4(final.xyz, 1.0f);              \n\
+        FragColor = vec4(shade(position, items[item].color.rgb), 1.0f);\n\
     }";
 
 const char* vertex_source_face = "                      \n\
-    #version 330 core                                   \n\
+    #version 330 core                                   \n"
+    RENDER_ITEMS_SOURCE "                               \n\
     layout (location = 0) in vec3 pos;                  \n\
-    layout (location = 1) in vec3 nor;                  \n\
     layout (location = 2) in vec2 tex;                  \n\
-    uniform mat4 transform;                             \n\
-    uniform mat4 rotate;                                \n\
-    out vec4 normal;                                    \n\
+    out vec3 position;                                  \n\
     out vec2 texcoord;                                  \n\
     void main(){                                        \n\
-        gl_Position = transform * vec4(pos.xyz, 1.0f);  \n\
-        normal = rotate * vec4(nor.xyz, 1.0f);          \n\
+        position = (items[item].transform * vec4(pos.xyz, 1.0f)).xyz;\n\
+        gl_Position = projection * vec4(position, 1.0f);\n\
         texcoord = tex;                                 \n\
     }";
 const char* fragment_source_face = "                    \n\
-    #version 330 core                                   \n\
-    in vec4 normal;                                     \n\
+    #version 330 core                                   \n"
+    RENDER_ITEMS_SOURCE RENDER_SHADE_SOURCE "           \n\
+    in vec3 position;                                   \n\
     in vec2 texcoord;                                   \n\
     uniform sampler2D image;                            \n\
     out vec4 FragColor;                                 \n\
     void main(){                                        \n\
-        vec3 shade = texture(image, texcoord.xy).xyz;       \n\
-        vec3 light1 = vec3(-0.70, 0.42, 0.58);          \n\
-        float diff1 = max(dot(light1, normal.xyz), 0.0);\n\
-        vec3 light2 = vec3(0.70, -0.42, -0.58);         \n\
-        float diff2 = max(dot(light2, normal.xyz), 0.0);\n\
-        float ambient = 0.1;                            \n\
-        vec3 final = (ambient+2*(diff1+diff2*0.5))*shade;\n\
-        //FragColor = vec4(final.xyz, 1.0f);              \n\
+        vec3 color = texture(image, texcoord.xy).xyz;   \n\
+        //FragColor = vec4(shade(position, color), 1.0f);\n\
         //don't use fancy shading on images to preserve original colors\n\
-        FragColor = vec4(shade.xyz, 1.0f);              \n\
+        FragColor = vec4(color.xyz, 1.0f);              \n\
     }";
 
 Image()  {
     initializeOpenGLFunctions();
 }
 
-void initialize(QString filepath){
+// Read the image at (filepath); this needs no OpenGL context, so it can
+// run on a background thread (see Loader). Returns false if there is none.
+bool prepare(QString filepath){
     this->filepath = filepath;
-    if(filepath == ""){ return; }
+    if(filepath == ""){ return false; }
     if(!(QFileInfo::exists(filepath) && QFileInfo(filepath).isFile())){
-        QMessageBox::warning(nullptr, "File Reading Error", "File not found: \""+filepath+"\".");
-        return;
+        qDebug() << "Error: image not found:" << filepath;
+        return false;
     }
 
+    release();
     image = new QImage();
     image->load(filepath);
     *image = image->mirrored(mirror_horizontal, mirror_vertical);
+    return true;
+}
+
+// Copy the image read by prepare() and its body to GPU memory.
+void upload(){
     texture = new QOpenGLTexture(*image);
     texture->setMagnificationFilter(QOpenGLTexture::Nearest);
     texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
 
     // TODO: assert lower < higher bounds
 
-    // position, normal, texture
+    // position, texture
     float image_vertices[] = {
-        xbounds[0], ybounds[0], zbounds[1], 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
-        xbounds[1], ybounds[0], zbounds[1], 0.0f, 0.0f, 1.0f, 1.0f, 0.0f,
-        xbounds[1], ybounds[1], zbounds[1], 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,
-        xbounds[1], ybounds[1], zbounds[1], 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,
-        xbounds[0], ybounds[1], zbounds[1], 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,
-        xbounds[0], ybounds[0], zbounds[1], 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+        xbounds[0], ybounds[0], zbounds[1], 0.0f, 0.0f,
+        xbounds[1], ybounds[0], zbounds[1], 1.0f, 0.0f,
+        xbounds[1], ybounds[1], zbounds[1], 1.0f, 1.0f,
+        xbounds[1], ybounds[1], zbounds[1], 1.0f, 1.0f,
+        xbounds[0], ybounds[1], zbounds[1], 0.0f, 1.0f,
+        xbounds[0], ybounds[0], zbounds[1], 0.0f, 0.0f,
     };
 
     face_VAO = new QOpenGLVertexArrayObject();
@@ -132,61 +130,52 @@ void initialize(QString filepath){
     face_VBO->create();
     face_VBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
     face_VBO->bind();
-    face_VBO->allocate(image_vertices, sizeof(float)*8*6);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)0);
+    face_VBO->allocate(image_vertices, sizeof(float)*5*6);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(3*sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(6*sizeof(float)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5*sizeof(float), (void*)(3*sizeof(float)));
     glEnableVertexAttribArray(2);
     face_VAO->release();
 
-    if(face_shader == nullptr){
-        // shader won't compile vertex shader twice for some reason, so only do it once
-        // TODO: figure out why
-        face_shader = new QOpenGLShaderProgram();
-        face_shader->addShaderFromSourceCode(QOpenGLShader::Vertex, vertex_source_face);
-        face_shader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragment_source_face);
-        face_shader->link();
-    }
+    face_shader = Shader::get(vertex_source_face, fragment_source_face);
 
-    // position, normal
+    // position (triangles wind counterclockwise seen from outside)
     float box_vertices[] = {
         // bottom
-        xbounds[0], ybounds[0], zbounds[0], 0.0f, 0.0f, -1.0f,
-        xbounds[1], ybounds[0], zbounds[0], 0.0f, 0.0f, -1.0f,
-        xbounds[1], ybounds[1], zbounds[0], 0.0f, 0.0f, -1.0f,
-        xbounds[1], ybounds[1], zbounds[0], 0.0f, 0.0f, -1.0f,
-        xbounds[0], ybounds[1], zbounds[0], 0.0f, 0.0f, -1.0f,
-        xbounds[0], ybounds[0], zbounds[0], 0.0f, 0.0f, -1.0f,
+        xbounds[0], ybounds[0], zbounds[0],
+        xbounds[1], ybounds[1], zbounds[0],
+        xbounds[1], ybounds[0], zbounds[0],
+        xbounds[1], ybounds[1], zbounds[0],
+        xbounds[0], ybounds[0], zbounds[0],
+        xbounds[0], ybounds[1], zbounds[0],
         // left
-        xbounds[0], ybounds[0], zbounds[0], -1.0f, 0.0f, 0.0f,
-        xbounds[0], ybounds[1], zbounds[0], -1.0f, 0.0f, 0.0f,
-        xbounds[0], ybounds[1], zbounds[1], -1.0f, 0.0f, 0.0f,
-        xbounds[0], ybounds[1], zbounds[1], -1.0f, 0.0f, 0.0f,
-        xbounds[0], ybounds[0], zbounds[1], -1.0f, 0.0f, 0.0f,
-        xbounds[0], ybounds[0], zbounds[0], -1.0f, 0.0f, 0.0f,
+        xbounds[0], ybounds[0], zbounds[0],
+        xbounds[0], ybounds[1], zbounds[1],
+        xbounds[0], ybounds[1], zbounds[0],
+        xbounds[0], ybounds[1], zbounds[1],
+        xbounds[0], ybounds[0], zbounds[0],
+        xbounds[0], ybounds[0], zbounds[1],
         // right
-        xbounds[1], ybounds[0], zbounds[0], 1.0f, 0.0f, 0.0f,
-        xbounds[1], ybounds[1], zbounds[0], 1.0f, 0.0f, 0.0f,
-        xbounds[1], ybounds[1], zbounds[1], 1.0f, 0.0f, 0.0f,
-        xbounds[1], ybounds[1], zbounds[1], 1.0f, 0.0f, 0.0f,
-        xbounds[1], ybounds[0], zbounds[1], 1.0f, 0.0f, 0.0f,
-        xbounds[1], ybounds[0], zbounds[0], 1.0f, 0.0f, 0.0f,
+        xbounds[1], ybounds[0], zbounds[0],
+        xbounds[1], ybounds[1], zbounds[0],
+        xbounds[1], ybounds[1], zbounds[1],
+        xbounds[1], ybounds[1], zbounds[1],
+        xbounds[1], ybounds[0], zbounds[1],
+        xbounds[1], ybounds[0], zbounds[0],
         // back
-        xbounds[0], ybounds[0], zbounds[0], 0.0f, -1.0f, 0.0f,
-        xbounds[0], ybounds[0], zbounds[1], 0.0f, -1.0f, 0.0f,
-        xbounds[1], ybounds[0], zbounds[1], 0.0f, -1.0f, 0.0f,
-        xbounds[1], ybounds[0], zbounds[1], 0.0f, -1.0f, 0.0f,
-        xbounds[1], ybounds[0], zbounds[0], 0.0f, -1.0f, 0.0f,
-        xbounds[0], ybounds[0], zbounds[0], 0.0f, -1.0f, 0.0f,
+        xbounds[0], ybounds[0], zbounds[0],
+        xbounds[1], ybounds[0], zbounds[1],
+        xbounds[0], ybounds[0], zbounds[1],
+        xbounds[1], ybounds[0], zbounds[1],
+        xbounds[0], ybounds[0], zbounds[0],
+        xbounds[1], ybounds[0], zbounds[0],
         // front
-        xbounds[0], ybounds[1], zbounds[0], 0.0f, 1.0f, 0.0f,
-        xbounds[0], ybounds[1], zbounds[1], 0.0f, 1.0f, 0.0f,
-        xbounds[1], ybounds[1], zbounds[1], 0.0f, 1.0f, 0.0f,
-        xbounds[1], ybounds[1], zbounds[1], 0.0f, 1.0f, 0.0f,
-        xbounds[1], ybounds[1], zbounds[0], 0.0f, 1.0f, 0.0f,
-        xbounds[0], ybounds[1], zbounds[0], 0.0f, 1.0f, 0.0f,
+        xbounds[0], ybounds[1], zbounds[0],
+        xbounds[0], ybounds[1], zbounds[1],
+        xbounds[1], ybounds[1], zbounds[1],
+        xbounds[1], ybounds[1], zbounds[1],
+        xbounds[1], ybounds[1], zbounds[0],
+        xbounds[0], ybounds[1], zbounds[0],
     };
 
     body_VAO = new QOpenGLVertexArrayObject();
@@ -196,32 +185,29 @@ void initialize(QString filepath){
     body_VBO->create();
     body_VBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
     body_VBO->bind();
-    body_VBO->allocate(box_vertices, sizeof(float)*6*6*5);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (void*)0);
+    body_VBO->allocate(box_vertices, sizeof(float)*3*6*5);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (void*)(3*sizeof(float)));
-    glEnableVertexAttribArray(1);
     body_VAO->release();
 
-    if(body_shader == nullptr){
-        // shader won't compile vertex shader twice for some reason, so only do it once
-        // TODO: figure out why
-        body_shader = new QOpenGLShaderProgram();
-        body_shader->addShaderFromSourceCode(QOpenGLShader::Vertex, vertex_source_body);
-        body_shader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragment_source_body);
-        body_shader->link();
-    }
+    body_shader = Shader::get(vertex_source_body, fragment_source_body);
 
     initialized = true;
 }
 
+// Free the image read by prepare(), whether or not it was uploaded.
+void release(){
+    delete image;
+    image = nullptr;
+}
+
 void deinitialize(){
     initialized = false;
     delete body_VBO;
     delete body_VAO;
     delete face_VBO;
     delete face_VAO;
-    delete image;
+    release();
     delete texture;
 }
 
@@ -230,36 +216,25 @@ void deinitialize(){
     if(initialized){
         deinitialize();
     }
-    delete body_shader;
-    delete face_shader;
+    release();
 }
 
-// draw mesh
-void render(glm::mat4 view, glm::mat4 rotate){
+// Queue the drawing of the image and its body in (queue), placed in view
+// coordinates by (transform).
+void render(RenderQueue& queue, glm::mat4 transform){
     if(initialized){
-        // TODO: rotate normals
-        body_shader->bind();
-        unsigned int matlocation = glGetUniformLocation(body_shader->programId(), "transform");
-        glUniformMatrix4fv(matlocation, 1, GL_FALSE, glm::value_ptr(view));
-        unsigned int rotlocation = glGetUniformLocation(body_shader->programId(), "rotate");
-        glUniformMatrix4fv(rotlocation, 1, GL_FALSE, glm::value_ptr(rotate));
-        unsigned int collocation = glGetUniformLocation(body_shader->programId(), "color");
-        glUniform3fv(collocation, 1, glm::value_ptr(color));
-        body_VAO->bind();
-        glDrawArrays(GL_TRIANGLES, 0, 6*6*5);
-        body_VAO->release();
-
-        // TODO: rotate normals
-        texture->bind();
-        face_shader->bind();
-        matlocation = glGetUniformLocation(face_shader->programId(), "transform");
-        glUniformMatrix4fv(matlocation, 1, GL_FALSE, glm::value_ptr(view));
-        rotlocation = glGetUniformLocation(face_shader->programId(), "rotate");
-        glUniformMatrix4fv(rotlocation, 1, GL_FALSE, glm::value_ptr(rotate));
-        face_VAO->bind();
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        face_VAO->release();
-
+        RENDER_ITEM item = {transform, glm::vec4(color, 1.0f), glm::vec4(zbounds, 0.0f, 0.0f)};
+        queue.add(body_shader, item, [this](){
+            body_VAO->bind();
+            glDrawArrays(GL_TRIANGLES, 0, 6*5);
+            body_VAO->release();
+        });
+        queue.add(face_shader, item, [this](){
+            texture->bind();
+            face_VAO->bind();
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            face_VAO->release();
+        });
     }
 }
 
@@ -0,0 +1,93 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <QString>
+#include <QDebug>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "part.h"
+
+// Loads the parts of one *.gdsiiview file without blocking the GUI.
+//
+// A background thread prepares each part in turn (reads the cache or the
+// GDSII file, indexes layers, and tessellates them; see Part::prepare()),
+// describing what it is doing in (status). Once all are prepared, (ready)
+// is set, and the GUI thread copies them to GPU memory by calls to
+// upload(), each taking about as long as it is allowed, so that the scene
+// already shown stays interactive until the new one replaces it. Setting
+// (cancel) (as the destructor does) stops the thread at its next check;
+// (finished) is set when the thread is done either way.
+class Loader{
+public:
+    std::vector<std::shared_ptr<Part>> parts; // (to be taken by the caller once uploaded)
+    bool reset_view = false; // whether to fit the view to the parts once shown
+    std::thread thread;
+    std::atomic<bool> ready{false}; // (parts prepared, to be uploaded)
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancel{false};
+    std::mutex status_mutex;
+    QString status; // (what the thread is doing)
+    size_t next_part = 0; // first part not yet uploaded
+
+Loader(const std::vector<std::shared_ptr<Part>>& parts){
+    this->parts = parts;
+}
+
+// Stop preparing, and wait for the thread. Parts partly uploaded free their
+// GPU memory, so the OpenGL context should be current.
+~Loader(){
+    cancel = true;
+    if(thread.joinable()){ thread.join(); }
+}
+
+void start(){
+    thread = std::thread(&Loader::prepare, this);
+}
+
+// What is being done (empty once prepared).
+QString progress(){
+    std::lock_guard<std::mutex> lock(status_mutex);
+    return status;
+}
+
+// Copy prepared parts to GPU memory, one mesh at a time, until (seconds)
+// have passed (at least one mesh is copied); returns true once all are.
+bool upload(double seconds){
+    if(!ready){ return false; }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while(next_part < parts.size()){
+        if(parts[next_part]->upload_next()){ next_part++; }
+        if(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() > seconds){ break; }
+    }
+    return next_part == parts.size();
+}
+
+private:
+void prepare(){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(size_t i=0; i<parts.size() && !cancel; i++){
+        QString part = QString("Part %1 of %2: ").arg(i+1).arg(parts.size());
+        parts[i]->prepare(cancel, [this, part](const QString& message){
+            std::lock_guard<std::mutex> lock(status_mutex);
+            status = part + message;
+        });
+    }
+    {
+        std::lock_guard<std::mutex> lock(status_mutex);
+        status = "";
+    }
+    if(!cancel){
+        qDebug() << "Prepared" << parts.size() << "parts in"
+                 << std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() << "s";
+        ready = true;
+    }
+    finished = true;
+}
+
+};
+
+#endif
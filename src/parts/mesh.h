@@ -1,16 +1,30 @@
 #ifndef MESH_H
 #define MESH_H
 
-#include <QOpenGLFunctions>
+#include <QOpenGLFunctions_3_3_Core>
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLBuffer>
 #include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLPixelTransferOptions>
 
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <limits>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include "glm/glm.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include "gdsii.h"
+#include "meshcache.h"
+#include "raster.h"
+#include "renderqueue.h"
+#include "shader.h"
+#include "scanline.h"
 
 extern "C" {
     #define ANSI_DECLARATORS
@@ -21,259 +35,1403 @@ extern "C" {
     #include "triangle.h"
 }
 
-class Mesh : protected QOpenGLFunctions {
+// (value of macro (x) as a string, for shader source)
+#define MESH_STRING(x) #x
+#define MESH_SOURCE_NUMBER(x) MESH_STRING(x)
+
+// Triangulation of a boundary by Triangle: points (each x, y, relative to
+// the first point of the boundary) and triangles (each three point numbers).
+struct MeshTriangulation{
+    std::vector<REAL> points;
+    std::vector<int> triangles;
+};
+
+// FNV-1a hash of the points of a boundary relative to its first point.
+struct MeshShapeHash{
+    size_t operator()(const std::vector<REAL64>& relative) const {
+        const unsigned char* bytes = (const unsigned char*)relative.data();
+        uint64_t hash = 14695981039346656037ULL;
+        for(size_t i=0; i<relative.size()*sizeof(REAL64); i++){
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+// Scratch space for triangulating boundaries, reused from one boundary to
+// the next (one per thread).
+struct MeshScratch{
+    static const size_t max_shapes = 65536; // (triangulations kept per thread)
+    std::vector<glm::vec2> points;
+    std::vector<glm::vec2> normals;
+    std::vector<REAL64> placed;
+    std::vector<REAL> pointlist;
+    std::vector<int> segmentlist;
+    std::vector<int> trianglelist;
+    std::vector<REAL64> relative;
+    std::unordered_map<std::vector<REAL64>, MeshTriangulation, MeshShapeHash> shapes; // (by relative points)
+    size_t num_fans = 0;            // (boundaries capped by each method)
+    size_t num_triangulated = 0;
+    size_t num_repeated = 0;        // (triangulated boundaries with the shape of an earlier one)
+};
+
+class Mesh : protected QOpenGLFunctions_3_3_Core {
 public:
     bool created = false;
     bool initialized = false;
     glm::vec3 color = glm::vec3(1.0f, 0.5f, 1.0f);
     glm::vec2 zbounds = glm::vec2(-1.0f, 1.0f);
-    std::vector<glm::vec3>mesh_points;
     int gdslayer = 1;
+    int gdsdatatype = -1; // (-1 for any datatype)
+    bool merge = false; // whether to merge overlapping polygons before extruding
     bool export_stl = false;
     std::string stlfilepath = "";
-    GDSII* gdsii;
-    unsigned int num_vertices = 0;
+    GDSII* gdsii = nullptr; // parsed GDSII file (owned by Part)
+    const GDSII_LAYER* layer = nullptr; // boundaries of this layer in (gdsii) (owned by Part)
+    MeshCache* cache = nullptr; // where to store tessellated mesh (owned by Part, or nullptr)
+    QByteArray cache_key;
+    const std::atomic<bool>* cancel = nullptr; // (set to stop tessellating early, or nullptr)
+    MeshCacheEntry cached; // mapped entry this mesh was prepared from, until uploaded
+    std::vector<int16_t> prepared_points; // mesh tessellated by prepare(), until uploaded
+    std::vector<int32_t> prepared_origins;
+    std::vector<uint32_t> prepared_indices;
+    std::vector<uint32_t> prepared_edges;
+    std::vector<glm::vec2> hull; // convex hull of mesh in x-y plane (for bounds)
+    size_t num_indices = 0;
+    std::vector<MESH_MASTER> masters; // triangles drawn at each of their placements
+    std::vector<MESH_PLACEMENT> placements;
+    std::vector<MESH_TILE> tiles; // (of triangles and of placements of masters)
+    std::vector<float> master_sizes; // largest extent of each master at any of its placements (model units)
+    size_t first_box = 0; // index of first triangle corner of caps of bounding box of each master (12 each)
+    size_t first_box_wall = 0; // first edge of sidewalls of bounding box of each master (4 each)
+    float lod_pixels = 3.0f; // instances of masters smaller than this on screen are drawn as boxes (pixels)
+    size_t num_triangles = 0; // (counting every instance)
+    float impostor_density = 1.0f; // triangles per pixel above which top views are drawn from (raster)
+    int raster_side = 2048; // (pixels along longer side of base level of raster)
+    RASTER raster; // coverage of top faces, built in the background
+    std::thread raster_thread;
+    std::atomic<bool> raster_ready{false};
+    std::atomic<bool> raster_cancel{false};
+    QOpenGLTexture* raster_texture = nullptr;
+    QOpenGLVertexArrayObject* impostor_VAO = nullptr;
+    QOpenGLBuffer* impostor_VBO = nullptr;
+    Shader* impostor_shader = nullptr; // (owned by Shader registry)
+    std::vector<GLsizei> draw_counts; // (scratch for drawing tiles)
+    std::vector<GLint> draw_firsts;
+    std::vector<const GLvoid*> draw_offsets;
     QOpenGLVertexArrayObject* VAO;
-    QOpenGLBuffer* VBO;
-    QOpenGLShaderProgram* shader = nullptr;
+    QOpenGLBuffer* VBO; // (points, as offsets from their block origins)
+    QOpenGLBuffer* OBO; // (block origins)
+    QOpenGLBuffer* IBO;
+    QOpenGLBuffer* EBO; // (edges of sidewalls)
+    QOpenGLBuffer* PBO; // (placements)
+    GLuint points_texture = 0; // (VBO, OBO and EBO, read by the vertex shader)
+    GLuint origins_texture = 0;
+    GLuint edges_texture = 0;
+    Shader* shader = nullptr; // (owned by Shader registry)
 
 // this is messy, but easier than separate files
+//
+// The mesh is flat, and extruded from zbounds.x (top) to zbounds.y
+// (bottom) here. Point i is at (points) i plus the origin of its block in
+// (origins) (database units; blocks of MESH_BLOCK_SIZE points; see pack()),
+// and (unit) model units per database unit. Caps are drawn by index: index
+// 2*i is point i on the top face, and 2*i+1 the same point on the bottom
+// face. Sidewalls are drawn, if (walls), by vertex number: vertices 6*i
+// ... 6*i+5 are the two triangles of the wall over edge i in (edges),
+// whose outside is on the right going from its first point to its second.
+// Points are exact integers until they are scaled into model units, and
+// equal points stay equal, so faces that share edges meet. But positions
+// are then floats, with 24 bits of precision, in this shader and in the
+// placement and view transforms. So beyond 2^24 database units from the
+// origin (about 16.7 mm at 1 nm per unit), floats are spaced more than a
+// unit apart (about 2 nm at 30 mm), and neighboring points on the database
+// grid may be drawn at the same position. Keeping them apart across a
+// whole reticle would need the transforms to be taken relative to the eye
+// in double precision.
 const char* vertex_source = "                           \n\
-    #version 330 core                                   \n\
-    layout (location = 0) in vec3 pos;                  \n\
-    layout (location = 1) in vec3 nor;                  \n\
-    uniform mat4 transform;                             \n\
-    uniform mat4 rotate;                                \n\
-    out vec4 normal;                                    \n\
+    #version 330 core                                   \n"
+    RENDER_ITEMS_SOURCE "                               \n\
+    layout (location = 2) in vec4 linear;               \n\
+    layout (location = 3) in vec4 offset_column;        \n\
+    layout (location = 4) in vec4 row_size;             \n\
+    uniform isamplerBuffer points;                      \n\
+    uniform isamplerBuffer origins;                     \n\
+    uniform usamplerBuffer edges;                       \n\
+    uniform float unit;                                 \n\
+    uniform bool walls;                                 \n\
+    const int quad[6] = int[6](0, 2, 1, 2, 0, 3);       \n\
+    out vec3 position;                                  \n\
+    ivec2 point(int i){                                 \n\
+        return texelFetch(origins, i / " MESH_SOURCE_NUMBER(MESH_BLOCK_SIZE) ").xy + texelFetch(points, i).xy;\n\
+    }                                                   \n\
     void main(){                                        \n\
-        gl_Position = transform * vec4(pos.xyz, 1.0f);  \n\
-        normal = rotate * vec4(nor.xyz, 1.0f);          \n\
+        vec2 zbounds = items[item].zbounds.xy;          \n\
+        vec2 pos;                                       \n\
+        float z;                                        \n\
+        if(walls){                                      \n\
+            uvec2 edge = texelFetch(edges, gl_VertexID / 6).xy;\n\
+            ivec2 p1 = point(int(edge.x));              \n\
+            ivec2 p2 = point(int(edge.y));              \n\
+            int corner = quad[gl_VertexID % 6];         \n\
+            pos = vec2((corner == 0 || corner == 3) ? p1 : p2)*unit;\n\
+            z = corner < 2 ? zbounds.x : zbounds.y;     \n\
+        }else{                                          \n\
+            pos = vec2(point(gl_VertexID / 2))*unit;    \n\
+            z = (gl_VertexID % 2) == 1 ? zbounds.y : zbounds.x;\n\
+        }                                               \n\
+        int columns = int(row_size.z);                  \n\
+        vec2 copy = vec2(gl_InstanceID % columns, gl_InstanceID / columns);\n\
+        mat2 place = mat2(linear.xy, linear.zw);        \n\
+        vec2 xy = place*pos + offset_column.xy + copy.x*offset_column.zw + copy.y*row_size.xy;\n\
+        position = (items[item].transform * vec4(xy, z, 1.0f)).xyz;\n\
+        gl_Position = projection * vec4(position, 1.0f);\n\
     }";
 const char* fragment_source = "                         \n\
-    #version 330 core                                   \n\
-    uniform vec3 color;                                 \n\
-    in vec4 normal;                                     \n\
+    #version 330 core                                   \n"
+    RENDER_ITEMS_SOURCE RENDER_SHADE_SOURCE "           \n\
+    in vec3 position;                                   \n\
+    out vec4 FragColor;                                 \n\
+    void main(){                                        \n\
+        FragColor = vec4(shade(position, items[item].color.rgb), 1.0f);\n\
+    }";
+
+// top face of whole mesh, covered where (coverage) is
+const char* impostor_vertex_source = "                  \n\
+    #version 330 core                                   \n"
+    RENDER_ITEMS_SOURCE "                               \n\
+    layout (location = 0) in vec4 pos_tex;              \n\
+    out vec3 position;                                  \n\
+    out vec2 texcoord;                                  \n\
+    void main(){                                        \n\
+        position = (items[item].transform * vec4(pos_tex.xy, items[item].zbounds.x, 1.0f)).xyz;\n\
+        gl_Position = projection * vec4(position, 1.0f);\n\
+        texcoord = pos_tex.zw;                          \n\
+    }";
+const char* impostor_fragment_source = "                \n\
+    #version 330 core                                   \n"
+    RENDER_ITEMS_SOURCE RENDER_SHADE_SOURCE "           \n\
+    uniform sampler2D coverage;                         \n\
+    in vec3 position;                                   \n\
+    in vec2 texcoord;                                   \n\
     out vec4 FragColor;                                 \n\
     void main(){                                        \n\
-        vec3 light1 = vec3(-0.70, 0.42, 0.58);          \n\
-        float diff1 = max(dot(light1, normal.xyz), 0.0);\n\
-        vec3 light2 = vec3(0.70, -0.42, -0.58);         \n\
-        float diff2 = max(dot(light2, normal.xyz), 0.0);\n\
-        float ambient = 0.1;                            \n\
-        vec3 final = (ambient+2*(diff1+diff2*0.5))*color;\n\
-        FragColor = vec4(final.xyz, 1.0f);              \n\
+        vec3 color = shade(position, items[item].color.rgb); // (before discarding, for derivatives)\n\
+        if(texture(coverage, texcoord).r < 0.25){ discard; }\n\
+        FragColor = vec4(color, 1.0f);                  \n\
     }";
 
 Mesh()  {
     initializeOpenGLFunctions();
 }
 
-void initialize(){
+void order_zbounds(){
+    if(zbounds.y > zbounds.x){ // ensure z bound order
+        zbounds = glm::vec2(zbounds.y, zbounds.x);
+    };
+}
+
+// The mesh is made in two steps: prepare_from_cache() or prepare() make
+// it in main memory, and need no OpenGL context, so they can run on a
+// background thread (see Loader); upload_prepared() then copies it to GPU
+// memory, with the context current.
+
+// Use the tessellated mesh from (cache), if it is there; it stays mapped
+// until upload_prepared().
+bool prepare_from_cache(){
+    order_zbounds();
+    if(cache == nullptr || !cache->load(cache_key, gdslayer, gdsdatatype, cached)){ return false; }
+    hull.resize(cached.header->num_hull);
+    for(unsigned int i=0; i<hull.size(); i++){
+        hull[i] = glm::vec2(cached.hull[2*i], cached.hull[2*i+1]);
+    }
+    masters.assign(cached.masters, cached.masters + cached.header->num_masters);
+    placements.assign(cached.placements, cached.placements + cached.header->num_placements);
+    tiles.assign(cached.tiles, cached.tiles + cached.header->num_tiles);
+    return true;
+}
+
+// Tessellate the boundaries of (layer) in (gdsii), and store the mesh in
+// (cache), unless (cancel) is set first.
+void prepare(){
     //std::cout << "Mesh initialized with layer " << gdslayer << std::endl;
     if(export_stl){
         //std::cout << "Exporting mesh to stl at " << stlfilepath << std::endl;
     }
 
-    std::vector<float> vertices;
+    std::vector<int32_t> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> edges;
 
-    if(zbounds.y > zbounds.x){ // ensure z bound order
-        zbounds = glm::vec2(zbounds.y, zbounds.x);
+    order_zbounds();
+
+    if(merge){
+        add_union(vertices, indices, edges);
+    }else{
+        add_boundaries(vertices, indices, edges);
+    }
+
+    if(cancel != nullptr && *cancel){ return; }
+    std::vector<int16_t>& points = prepared_points;
+    std::vector<int32_t>& origins = prepared_origins;
+    pack(vertices, indices, edges, points, origins);
+    std::vector<int32_t>().swap(vertices);
+    prepared_indices.swap(indices);
+    prepared_edges.swap(edges);
+
+    if(cache != nullptr){
+        std::vector<float> hull_floats;
+        for(unsigned int i=0; i<hull.size(); i++){
+            hull_floats.push_back(hull[i].x);
+            hull_floats.push_back(hull[i].y);
+        }
+        cache->store(cache_key, gdslayer, gdsdatatype, hull_floats, points, origins, prepared_indices, prepared_edges,
+                     masters, placements, tiles);
+    }
+}
+
+// Copy the mesh made by prepare_from_cache() or prepare() to GPU memory,
+// and free it from main memory.
+void upload_prepared(){
+    if(cached.header != nullptr){
+        upload(cached.points, cached.origins, cached.header->num_points, cached.indices, cached.header->num_indices,
+               cached.edges, cached.header->num_edges); // straight from the mapped file
+        cache->release(cached);
+    }else{
+        upload(prepared_points.data(), prepared_origins.data(), prepared_points.size()/2,
+               prepared_indices.data(), prepared_indices.size(), prepared_edges.data(), prepared_edges.size()/2);
+    }
+    std::vector<int16_t>().swap(prepared_points);
+    std::vector<int32_t>().swap(prepared_origins);
+    std::vector<uint32_t>().swap(prepared_indices);
+    std::vector<uint32_t>().swap(prepared_edges);
+}
+
+// Pack (vertices) (x, y of each point, in database units) into (points),
+// as 16-bit offsets from the origin of their block of MESH_BLOCK_SIZE
+// points in (origins). Points are taken in order while they fit in one
+// block, i.e. span at most 65535 units in x and in y, and the origin is
+// then put in the middle of their span; a block is padded (with unused
+// points at its origin) before the point that does not fit, and so is the
+// last block. (indices) of caps and (edges) (pairs of point numbers) are
+// renumbered to match. So points on the database grid are kept exactly,
+// in half the memory of floats.
+static void pack(const std::vector<int32_t>& vertices, std::vector<uint32_t>& indices, std::vector<uint32_t>& edges,
+                 std::vector<int16_t>& points, std::vector<int32_t>& origins){
+    size_t num_points = vertices.size()/2;
+    std::vector<uint32_t> renumbered(num_points);
+    points.clear();
+    origins.clear();
+    points.reserve(vertices.size());
+    size_t first = 0; // (first point of the current block)
+    while(first < num_points){
+        int64_t min[2] = {vertices[2*first], vertices[2*first+1]}, max[2] = {min[0], min[1]};
+        size_t end = first + 1;
+        while(end < num_points && end-first < MESH_BLOCK_SIZE){
+            int64_t x = vertices[2*end], y = vertices[2*end+1];
+            if(std::max(max[0], x) - std::min(min[0], x) > UINT16_MAX ||
+               std::max(max[1], y) - std::min(min[1], y) > UINT16_MAX){ break; }
+            min[0] = std::min(min[0], x); max[0] = std::max(max[0], x);
+            min[1] = std::min(min[1], y); max[1] = std::max(max[1], y);
+            end++;
+        }
+        int64_t origin[2] = {min[0] - INT16_MIN, min[1] - INT16_MIN};
+        origins.push_back(origin[0]);
+        origins.push_back(origin[1]);
+        for(size_t i=first; i<end; i++){
+            renumbered[i] = points.size()/2;
+            points.push_back(vertices[2*i] - origin[0]);
+            points.push_back(vertices[2*i+1] - origin[1]);
+        }
+        points.resize(2*(origins.size()/2)*MESH_BLOCK_SIZE, 0);
+        first = end;
+    }
+    for(size_t i=0; i<indices.size(); i++){
+        indices[i] = 2*renumbered[indices[i]/2] + indices[i]%2;
+    }
+    for(size_t i=0; i<edges.size(); i++){
+        edges[i] = renumbered[edges[i]];
+    }
+}
+
+// Triangulate every boundary on this layer separately, and list the edges
+// of its sidewalls.
+//
+// A structure placed more than once (in the whole hierarchy) is tessellated
+// once, in its own coordinates, as a master drawn at each of its
+// placements; a lattice of placements by an AREF is one placement. All
+// other boundaries are tessellated in place, as the first master, so a
+// flat layout is still one draw call. GPU memory then grows with the
+// number of distinct structures and placements rather than instances.
+void add_boundaries(std::vector<int32_t>& vertices, std::vector<uint32_t>& indices, std::vector<uint32_t>& edges){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    float scale = 1000.0f; // (as in add_boundary())
+
+    // list every lattice of instances of every structure in the hierarchy
+    // that has boundaries on this layer, and count instances of each
+    struct VISIT{
+        const GDSII_STRUCTURE* structure;
+        GDSII_TRANSFORM transform;
+        GDSII_LATTICE lattice;
     };
+    std::vector<VISIT> visits;
+    std::vector<size_t> num_copies((*gdsii).num_structures, 0);
+    gdsii_visit_lattices(gdsii, [&](const GDSII_STRUCTURE* structure, const GDSII_TRANSFORM& transform,
+                                    const GDSII_LATTICE& lattice){
+        uint32_t s = structure->index;
+        if(!layer->used[s]){ return false; }
+        if(layer->start[s+1] > layer->start[s]){
+            visits.push_back({structure, transform, lattice});
+            num_copies[s] += (size_t)lattice.columns*lattice.rows;
+        }
+        return true;
+    });
 
-    GDSII_STRUCTURE* structure = gdsii->structure;
-    while(structure != NULL){
-        if(QString(structure->name) == "$$$CONTEXT_INFO$$$"){
-            // skip KLayout PCELL structures
-            structure = structure->next;
-            continue;
+    // list the instances to tessellate, grouped by master
+    struct INSTANCE{
+        const GDSII_STRUCTURE* structure;
+        GDSII_TRANSFORM transform;
+    };
+    std::vector<INSTANCE> instances;
+    std::vector<size_t> master_instance; // first instance of each master (and total)
+    std::vector<std::vector<MESH_PLACEMENT>> singles, lattices; // placements of each master
+    for(size_t i=0; i<visits.size(); i++){
+        if(num_copies[visits[i].structure->index] == 1){
+            instances.push_back({visits[i].structure, visits[i].transform});
+        }
+    }
+    if(!instances.empty()){
+        master_instance.push_back(0);
+        singles.push_back(std::vector<MESH_PLACEMENT>(1, placement(gdsii_identity_transform(), scale)));
+        lattices.push_back(std::vector<MESH_PLACEMENT>());
+    }
+    std::vector<uint32_t> master_of((*gdsii).num_structures, std::numeric_limits<uint32_t>::max());
+    for(size_t i=0; i<visits.size(); i++){
+        uint32_t s = visits[i].structure->index;
+        if(num_copies[s] == 1){ continue; }
+        if(master_of[s] == std::numeric_limits<uint32_t>::max()){
+            master_of[s] = master_instance.size();
+            master_instance.push_back(instances.size());
+            instances.push_back({visits[i].structure, gdsii_identity_transform()});
+            singles.push_back(std::vector<MESH_PLACEMENT>());
+            lattices.push_back(std::vector<MESH_PLACEMENT>());
         }
-        GDSII_ELEMENT* element = structure->element;
-        while(element != NULL){
-            if(element->layer == gdslayer && element->type == ELEMENT_TYPE_BOUNDARY){
+        if(visits[i].lattice.columns*visits[i].lattice.rows == 1){
+            singles[master_of[s]].push_back(placement(visits[i].transform, scale));
+        }else{
+            lattices[master_of[s]].push_back(placement(visits[i].transform, scale, &visits[i].lattice));
+        }
+    }
+    size_t num_masters = master_instance.size();
+    master_instance.push_back(instances.size());
 
-                // Only consider polygons with at least 3 points.
-                if(element->point == NULL ||
-                   element->point->next == NULL ||
-                   element->point->next->next == NULL){continue;}
-
-                float scale = 1000.0f; // (GDSII database units per model unit) TODO: update to use GDSII file units
-
-                // Loop through the points of the polygon in two passes.
-                // During the first pass, count the number of points, extract
-                // the points and calculate normal vectors to each edge, and
-                // determine whether the edge winds clockwise (CW) or
-                // counterclockwise (CCW).
-                unsigned int num_points = 0;
-                std::vector<glm::vec2> points;
-                std::vector<glm::vec2> normals;
-                float area = 0.0f;
-                GDSII_POINT* point = element->point;
-                while(point->next != NULL){ // skip last point, which is a duplicate of the first
-                    num_points += 1;
-                    glm::vec2 scaled_point = glm::vec2(point->x/scale, point->y/scale);
-                    glm::vec2 scaled_point_next = glm::vec2(point->next->x/scale, point->next->y/scale);
-                    glm::vec2 normal = glm::vec2(scaled_point_next.y-scaled_point.y,
-                                                 scaled_point.x-scaled_point_next.x);
-                    normal /= glm::length(normal);
-                    points.push_back(scaled_point);
-                    normals.push_back(normal);
-                    area += (point->next->x-point->x)*(point->next->y+point->y); // 2 * area between line and x-axis
-                    point = point->next;
-                }
-                bool CW = area > 0; // polygon is clockwise if area is positive, CCW otherwise
-
-                // During the second pass, (1) offset each point along its
-                // adjacent edge normals by a small amount delta to help
-                // triangulate weird polygons, (2) create edge polygons,
-                // and (3) prepare to triangulate the polygon.
-                struct triangulateio in, out;
-                in.numberofpoints = num_points;
-                in.numberofpointattributes = 0;
-                in.pointmarkerlist = NULL;
-                in.pointlist = (REAL *) malloc(in.numberofpoints * 2 * sizeof(REAL));
-                in.numberofsegments = num_points;
-                in.segmentmarkerlist = NULL;
-                in.segmentlist = (int *) malloc(in.numberofsegments * 2 * sizeof(int));
-                in.numberofholes = 0;
-                in.holelist = NULL;
-                //in.numberofholes = num_points;
-                //in.holelist = (REAL *) malloc(in.numberofsegments * 2 * sizeof(REAL));
-                for(unsigned int i=0; i<num_points; i++){
-
-                    float delta = 0.01f;
-                    //float delta = 0.1f/scale; // fix to database units
-
-                    // get points and normals
-                    int di = num_points+1;
-                    if(CW){ di = num_points-1; };
-                    glm::vec2 p1 = points[i];
-                    glm::vec2 p2 = points[(i+di)%num_points];
-                    glm::vec2 normal_1a = normals[(i)%num_points];
-                    glm::vec2 normal_1b = normals[(i+di)%num_points];
-                    glm::vec2 normal_2a = normals[(i+di)%num_points];
-                    glm::vec2 normal_2b = normals[(i+di+di)%num_points];
-                    if(CW){
-                        normal_1a = -normal_1a;
-                        normal_1b = -normal_1b;
-                        normal_2a = -normal_2a;
-                        normal_2b = -normal_2b;
-                    }
-                    p1 -= delta*(normal_1a + normal_1b);
-                    p2 -= delta*(normal_2a + normal_2b);
-                    float z1 = zbounds[0]; float z2 = zbounds[1];
-
-                    float tris[] = {
-                        p1.x, p1.y, z1, normal_1b.x, normal_1b.y, 0,
-                        p2.x, p2.y, z1, normal_1b.x, normal_1b.y, 0,
-                        p2.x, p2.y, z2, normal_1b.x, normal_1b.y, 0,
-                        p2.x, p2.y, z2, normal_1b.x, normal_1b.y, 0,
-                        p1.x, p1.y, z2, normal_1b.x, normal_1b.y, 0,
-                        p1.x, p1.y, z1, normal_1b.x, normal_1b.y, 0,
-                    };
-                    for(unsigned int j=0; j<6*6; j++){
-                        vertices.push_back(tris[j]);
-                    }
+    std::vector<size_t> first; // index of first boundary of each instance (and total)
+    size_t num_boundaries = 0;
+    for(size_t i=0; i<instances.size(); i++){
+        uint32_t s = instances[i].structure->index;
+        first.push_back(num_boundaries);
+        num_boundaries += layer->start[s+1] - layer->start[s];
+    }
+    first.push_back(num_boundaries);
 
-                    in.pointlist[i*2] = p1.x;
-                    in.pointlist[i*2+1] = p1.y;
-                    in.segmentlist[i*2] = i;
-                    in.segmentlist[i*2+1] = (i+1) % num_points;
-
-                    /*
-                    glm::vec2 hole_marker = p1 + p2;
-                    hole_marker *= 0.5;
-                    hole_marker += 0.5f*delta*normal_1b;
-                    in.holelist[i*2] = hole_marker.x;
-                    in.holelist[i*2+1] = hole_marker.y;
-                    */
+    // Sort the boundaries of each master into tiles, by the centers of
+    // their bounding boxes on a grid of about (tile_size) boundaries per
+    // tile, so that the tiles out of view can be skipped when drawing.
+    const size_t tile_size = 1024;
+    std::vector<size_t> order(num_boundaries); // boundaries, tile by tile
+    std::vector<size_t> tile_start; // first position in (order) of each tile (and total)
+    std::vector<size_t> tile_master; // master of each tile
+    std::vector<glm::vec2> centers;
+    for(size_t m=0; m<num_masters; m++){
+        size_t begin = first[master_instance[m]];
+        size_t end = first[master_instance[m+1]];
+        centers.resize(end-begin);
+        for(size_t j=master_instance[m]; j<master_instance[m+1]; j++){
+            const GDSII_STRUCTURE* structure = instances[j].structure;
+            const GDSII_TRANSFORM& transform = instances[j].transform;
+            for(size_t k=first[j]; k<first[j+1]; k++){
+                uint32_t e = layer->element[layer->start[structure->index] + (k-first[j])];
+                const int32_t* xy = gdsii_element_xy(structure, e);
+                int32_t min[2] = {xy[0], xy[1]}, max[2] = {xy[0], xy[1]};
+                for(uint32_t i=1; i<structure->point_count[e]; i++){
+                    for(unsigned int a=0; a<2; a++){
+                        min[a] = std::min(min[a], xy[2*i+a]);
+                        max[a] = std::max(max[a], xy[2*i+a]);
+                    }
                 }
+                REAL64 x = 0.5*((REAL64)min[0] + max[0]), y = 0.5*((REAL64)min[1] + max[1]);
+                centers[k-begin] = glm::vec2(transform.a*x + transform.b*y + transform.tx,
+                                             transform.c*x + transform.d*y + transform.ty);
+            }
+        }
+        grid_sort(centers, tile_size, &order[begin], begin, tile_start);
+        tile_master.resize(tile_start.size(), m);
+    }
+    size_t num_tiles = tile_start.size();
+    tile_start.push_back(num_boundaries);
+
+    // Triangulate boundaries in fixed-size chunks on all processor cores.
+    // Each chunk has its own output, and chunks are concatenated in order,
+    // so the mesh is the same no matter how many threads there are.
+    // (Triangle is reentrant in the TRILIBRARY build: each call has its own
+    // mesh, and its few global variables are thread-local; see triangle.c.)
+    // Chunks do not span tiles.
+    const size_t chunk_size = 4096;
+    struct CHUNK{
+        size_t begin, end;      // positions in (order)
+        size_t tile;
+        std::vector<int32_t> vertices;
+        std::vector<uint32_t> indices; // caps (numbered from first point of chunk)
+        std::vector<uint32_t> edges; // sidewalls (likewise)
+    };
+    std::vector<CHUNK> chunks;
+    for(size_t t=0; t<num_tiles; t++){
+        for(size_t begin=tile_start[t]; begin<tile_start[t+1]; begin+=chunk_size){
+            CHUNK chunk;
+            chunk.begin = begin;
+            chunk.end = std::min(begin+chunk_size, tile_start[t+1]);
+            chunk.tile = t;
+            chunks.push_back(chunk);
+        }
+    }
+    size_t num_chunks = chunks.size();
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<size_t> num_fans(0);
+    std::atomic<size_t> num_triangulated(0);
+    std::atomic<size_t> num_repeated(0);
+    auto work = [&](){
+        MeshScratch scratch;
+        while(true){
+            size_t c = next_chunk++;
+            if(c >= num_chunks || (cancel != nullptr && *cancel)){ break; }
+            for(size_t p=chunks[c].begin; p<chunks[c].end; p++){
+                size_t k = order[p];
+                size_t j = std::upper_bound(first.begin(), first.end(), k) - first.begin() - 1; // (instance of boundary)
+                const GDSII_STRUCTURE* structure = instances[j].structure;
+                uint32_t e = layer->element[layer->start[structure->index] + (k-first[j])];
+                // Only consider polygons with at least 3 points.
+                if(structure->point_count[e] < 3){ continue; }
+                add_boundary(chunks[c].vertices, chunks[c].indices, chunks[c].edges, scratch, gdsii_element_xy(structure, e), structure->point_count[e], instances[j].transform);
+            }
+        }
+        num_fans += scratch.num_fans;
+        num_triangulated += scratch.num_triangulated;
+        num_repeated += scratch.num_repeated;
+    };
+    unsigned int num_threads = std::thread::hardware_concurrency();
+    if(num_threads == 0){ num_threads = 1; }
+    if(num_threads > num_chunks){ num_threads = num_chunks; }
+    std::vector<std::thread> threads;
+    for(unsigned int i=1; i<num_threads; i++){
+        threads.push_back(std::thread(work));
+    }
+    work();
+    for(unsigned int i=0; i<threads.size(); i++){
+        threads[i].join();
+    }
+    size_t num_coordinates = 0;
+    size_t num_indices = 0;
+    size_t num_edge_points = 0;
+    for(size_t c=0; c<num_chunks; c++){
+        num_coordinates += chunks[c].vertices.size();
+        num_indices += chunks[c].indices.size();
+        num_edge_points += chunks[c].edges.size();
+    }
+    vertices.reserve(num_coordinates);
+    indices.reserve(num_indices);
+    edges.reserve(num_edge_points);
+    tiles.assign(num_tiles, MESH_TILE());
+    std::vector<size_t> tile_floats(num_tiles+1, num_coordinates); // first point coordinate of each tile (and total)
+    for(size_t c=0; c<num_chunks; c++){
+        MESH_TILE& tile = tiles[chunks[c].tile];
+        if(c == 0 || chunks[c].tile != chunks[c-1].tile){
+            tile_floats[chunks[c].tile] = vertices.size();
+            tile.first = indices.size();
+            tile.count = 0;
+            tile.first_wall = edges.size()/2;
+            tile.num_walls = 0;
+        }
+        uint32_t base = vertices.size()/2; // (first point of chunk)
+        for(size_t i=0; i<chunks[c].indices.size(); i++){
+            indices.push_back(2*base + chunks[c].indices[i]);
+        }
+        for(size_t i=0; i<chunks[c].edges.size(); i++){
+            edges.push_back(base + chunks[c].edges[i]);
+        }
+        vertices.insert(vertices.end(), chunks[c].vertices.begin(), chunks[c].vertices.end());
+        tile.count += chunks[c].indices.size();
+        tile.num_walls += chunks[c].edges.size()/2;
+        chunks[c] = CHUNK();
+    }
+
+    // bounding boxes of tiles and masters
+    masters.resize(num_masters);
+    for(size_t m=0; m<num_masters; m++){
+        masters[m].num_tiles = 0;
+        masters[m].num_indices = 0;
+        masters[m].num_walls = 0;
+        masters[m].min[0] = masters[m].min[1] = std::numeric_limits<float>::max();
+        masters[m].max[0] = masters[m].max[1] = std::numeric_limits<float>::lowest();
+    }
+    for(size_t t=0; t<num_tiles; t++){
+        MESH_TILE& tile = tiles[t];
+        tile.min[0] = tile.min[1] = std::numeric_limits<float>::max();
+        tile.max[0] = tile.max[1] = std::numeric_limits<float>::lowest();
+        for(size_t i=tile_floats[t]; i<tile_floats[t+1]; i+=2){
+            for(unsigned int a=0; a<2; a++){
+                tile.min[a] = std::min(tile.min[a], vertices[i+a]/scale);
+                tile.max[a] = std::max(tile.max[a], vertices[i+a]/scale);
+            }
+        }
+        MESH_MASTER& master = masters[tile_master[t]];
+        if(master.num_tiles == 0){
+            master.first_tile = t;
+            master.first_index = tile.first;
+            master.first_wall = tile.first_wall;
+        }
+        master.num_tiles += 1;
+        master.num_indices += tile.count;
+        master.num_walls += tile.num_walls;
+        for(unsigned int a=0; a<2; a++){
+            master.min[a] = std::min(master.min[a], tile.min[a]);
+            master.max[a] = std::max(master.max[a], tile.max[a]);
+        }
+    }
 
-                in.numberofregions = 0;
-                in.regionlist = NULL;
-                // need set of vertices, segments
-                // eventually, see which triangles border edge, on which side, etc...
-                // -p = planar straight line graph
-                // -z = number from zero
-                // -V = verbose
-                // -Q = quiet
-                out.pointlist = NULL;
-                out.pointmarkerlist = NULL;
-                out.trianglelist = NULL;
-                out.segmentlist = NULL;
-                out.segmentmarkerlist = NULL;
-                triangulate((char*)"pzQ", &in, &out, NULL);
-                float z1 = zbounds[0]; float z2 = zbounds[1];
-                int num_corners = out.numberofcorners;
-                for(int i=0; i<out.numberoftriangles; i++){
-                    float tris[] = {
-                        // TODO: move points to account for GDS hole problems
-                        // TODO: make sure normals are right direction (z2>z1)
-                        (float)out.pointlist[out.trianglelist[i*num_corners]*2+0],
-                        (float)out.pointlist[out.trianglelist[i*num_corners]*2+1], z1,0,0,1,
-                        (float)out.pointlist[out.trianglelist[i*num_corners+1]*2+0],
-                        (float)out.pointlist[out.trianglelist[i*num_corners+1]*2+1], z1,0,0,1,
-                        (float)out.pointlist[out.trianglelist[i*num_corners+2]*2+0],
-                        (float)out.pointlist[out.trianglelist[i*num_corners+2]*2+1], z1,0,0,1,
-                        (float)out.pointlist[out.trianglelist[i*num_corners]*2+0],
-                        (float)out.pointlist[out.trianglelist[i*num_corners]*2+1], z2,0,0,-1,
-                        (float)out.pointlist[out.trianglelist[i*num_corners+1]*2+0],
-                        (float)out.pointlist[out.trianglelist[i*num_corners+1]*2+1], z2,0,0,-1,
-                        (float)out.pointlist[out.trianglelist[i*num_corners+2]*2+0],
-                        (float)out.pointlist[out.trianglelist[i*num_corners+2]*2+1], z2,0,0,-1,
-                    };
-
-                    for(unsigned int j=0; j<6*6; j++){
-                        vertices.push_back(tris[j]);
+    // Placements of each master: single placements first, sorted into
+    // groups (tiles) like boundaries, then lattices. Mirrored placements
+    // are grouped apart from the others, since they reverse the winding of
+    // the triangles (see use_placements()).
+    placements.clear();
+    std::vector<MESH_PLACEMENT> handed[2]; // (unmirrored, mirrored)
+    std::vector<size_t> group_order;
+    std::vector<size_t> group_start;
+    for(size_t m=0; m<num_masters; m++){
+        MESH_MASTER& master = masters[m];
+        master.first_placement = placements.size();
+        master.num_singles = singles[m].size();
+        master.num_placements = singles[m].size() + lattices[m].size();
+        master.first_group = tiles.size();
+        handed[0].clear();
+        handed[1].clear();
+        for(size_t i=0; i<singles[m].size(); i++){
+            handed[mirrored(singles[m][i]) ? 1 : 0].push_back(singles[m][i]);
+        }
+        glm::vec2 center = glm::vec2(0.5f*(master.min[0]+master.max[0]), 0.5f*(master.min[1]+master.max[1]));
+        for(unsigned int h=0; h<2; h++){
+            const std::vector<MESH_PLACEMENT>& list = handed[h];
+            centers.resize(list.size());
+            for(size_t i=0; i<list.size(); i++){
+                const MESH_PLACEMENT& placed = list[i];
+                centers[i] = glm::vec2(placed.linear[0]*center.x + placed.linear[2]*center.y + placed.offset[0],
+                                       placed.linear[1]*center.x + placed.linear[3]*center.y + placed.offset[1]);
+            }
+            group_order.resize(list.size());
+            group_start.clear();
+            grid_sort(centers, tile_size, group_order.data(), 0, group_start);
+            group_start.push_back(list.size());
+            for(size_t g=0; g+1<group_start.size(); g++){
+                MESH_TILE group;
+                group.first = placements.size();
+                group.count = group_start[g+1] - group_start[g];
+                group.first_wall = group.num_walls = 0;
+                float min[2], max[2];
+                placed_box(master.min, master.max, list[group_order[group_start[g]]], min, max);
+                for(size_t i=group_start[g]; i<group_start[g+1]; i++){
+                    const MESH_PLACEMENT& placed = list[group_order[i]];
+                    float placed_min[2], placed_max[2];
+                    placed_box(master.min, master.max, placed, placed_min, placed_max);
+                    for(unsigned int a=0; a<2; a++){
+                        min[a] = std::min(min[a], placed_min[a]);
+                        max[a] = std::max(max[a], placed_max[a]);
                     }
+                    placements.push_back(placed);
                 }
+                memcpy(group.min, min, sizeof(min));
+                memcpy(group.max, max, sizeof(max));
+                tiles.push_back(group);
+            }
+        }
+        master.num_groups = tiles.size() - master.first_group;
+        placements.insert(placements.end(), lattices[m].begin(), lattices[m].end());
+    }
 
-                // store points to help fit view later
-                for(unsigned int i=0; i<points.size(); i++){
-                    mesh_points.push_back(glm::vec3(points[i].x, points[i].y, z1));
-                    mesh_points.push_back(glm::vec3(points[i].x, points[i].y, z2));
+    // hull of the hulls of the masters at each placement
+    std::chrono::steady_clock::time_point hull_start = std::chrono::steady_clock::now();
+    std::vector<float> corners;
+    for(size_t m=0; m<num_masters; m++){
+        size_t begin = tile_floats[masters[m].first_tile];
+        size_t end = tile_floats[masters[m].first_tile + masters[m].num_tiles];
+        std::vector<glm::vec2> master_hull = convex_hull(vertices.data()+begin, (end-begin)/2, 2, 1.0f/scale);
+        for(size_t p=masters[m].first_placement; p<masters[m].first_placement+masters[m].num_placements; p++){
+            const MESH_PLACEMENT& placed = placements[p];
+            for(unsigned int i=0; i<master_hull.size(); i++){
+                glm::vec2 q = master_hull[i];
+                glm::vec2 corner = glm::vec2(placed.linear[0]*q.x + placed.linear[2]*q.y + placed.offset[0],
+                                             placed.linear[1]*q.x + placed.linear[3]*q.y + placed.offset[1]);
+                for(unsigned int j=0; j<4; j++){ // (corners of lattice)
+                    float column = (j%2)*(placed.columns-1), row = (j/2)*(placed.rows-1);
+                    glm::vec2 point = corner + glm::vec2(column*placed.column[0] + row*placed.row[0],
+                                                         column*placed.column[1] + row*placed.row[1]);
+                    corners.push_back(point.x);
+                    corners.push_back(point.y);
+                    if(placed.columns*placed.rows == 1){ break; } // (not a lattice)
                 }
-                // end polygon
             }
-            element = element->next;
         }
-        structure = structure->next;
     }
+    hull = convex_hull(corners.data(), corners.size()/2, 2, 1.0f);
+    double hull_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-hull_start).count();
+
+    size_t num_instances = 0;
+    for(size_t p=0; p<placements.size(); p++){
+        num_instances += (size_t)placements[p].columns*placements[p].rows;
+    }
+    qDebug() << "Tessellated" << num_boundaries << "boundaries on layer" << gdslayer << "in"
+             << std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count()
+             << "s (" << hull_seconds << "s of that for the hull) on" << (num_threads > 0 ? num_threads : 1) << "threads (" << (size_t)num_fans << "convex,"
+             << (size_t)num_triangulated << "triangulated," << (size_t)num_repeated << "of those repeated shapes ="
+             << (num_triangulated > 0 ? 100.0*num_repeated/num_triangulated : 0.0) << "% hit rate) as"
+             << num_masters << "masters at" << placements.size() << "placements (" << num_instances << "instances)";
+}
+
+// Placement of a master by (transform) (in database units), or of a lattice
+// of masters displaced along (lattice).
+static MESH_PLACEMENT placement(const GDSII_TRANSFORM& transform, float scale, const GDSII_LATTICE* lattice = nullptr){
+    MESH_PLACEMENT placed;
+    placed.linear[0] = transform.a; placed.linear[1] = transform.c;
+    placed.linear[2] = transform.b; placed.linear[3] = transform.d;
+    placed.offset[0] = transform.tx/scale;
+    placed.offset[1] = transform.ty/scale;
+    placed.column[0] = placed.column[1] = placed.row[0] = placed.row[1] = 0;
+    placed.columns = placed.rows = 1;
+    if(lattice != nullptr){
+        placed.column[0] = (*lattice).column[0]/scale;
+        placed.column[1] = (*lattice).column[1]/scale;
+        placed.row[0] = (*lattice).row[0]/scale;
+        placed.row[1] = (*lattice).row[1]/scale;
+        placed.columns = (*lattice).columns;
+        placed.rows = (*lattice).rows;
+    }
+    return placed;
+}
+
+// Whether (placed) mirrors the master (reverses the winding of triangles).
+static bool mirrored(const MESH_PLACEMENT& placed){
+    return placed.linear[0]*placed.linear[3] - placed.linear[1]*placed.linear[2] < 0;
+}
+
+// Bounding box (out_min, out_max) of the box (min, max) at (placed) (all
+// copies, for a lattice).
+static void placed_box(const float min[2], const float max[2], const MESH_PLACEMENT& placed,
+                       float out_min[2], float out_max[2]){
+    out_min[0] = out_min[1] = std::numeric_limits<float>::max();
+    out_max[0] = out_max[1] = std::numeric_limits<float>::lowest();
+    for(unsigned int j=0; j<4; j++){
+        float x = (j%2) ? max[0] : min[0], y = (j/2) ? max[1] : min[1];
+        float corner[2] = {placed.linear[0]*x + placed.linear[2]*y + placed.offset[0],
+                           placed.linear[1]*x + placed.linear[3]*y + placed.offset[1]};
+        for(unsigned int a=0; a<2; a++){
+            out_min[a] = std::min(out_min[a], corner[a]);
+            out_max[a] = std::max(out_max[a], corner[a]);
+        }
+    }
+    for(unsigned int a=0; a<2; a++){
+        float column = (placed.columns-1)*placed.column[a], row = (placed.rows-1)*placed.row[a];
+        out_min[a] += std::min(0.0f, column) + std::min(0.0f, row);
+        out_max[a] += std::max(0.0f, column) + std::max(0.0f, row);
+    }
+}
+
+// Sort (points) into the cells of a grid over their bounding box with about
+// (tile_size) points per cell, row by row: fill (order) with (base) plus the
+// number of each point, cell by cell, and append the position in (order)
+// (plus base) of the first point of each cell that has any to (start).
+static void grid_sort(const std::vector<glm::vec2>& points, size_t tile_size, size_t* order, size_t base,
+                      std::vector<size_t>& start){
+    size_t n = points.size();
+    if(n == 0){ return; }
+    glm::vec2 low = points[0], high = points[0];
+    for(size_t i=1; i<n; i++){
+        low = glm::vec2(std::min(low.x, points[i].x), std::min(low.y, points[i].y));
+        high = glm::vec2(std::max(high.x, points[i].x), std::max(high.y, points[i].y));
+    }
+    unsigned int side = (unsigned int)std::ceil(std::sqrt((double)n/tile_size));
+    if(side < 1){ side = 1; }
+    std::vector<uint32_t> cell(n);
+    std::vector<size_t> first(side*side+1, 0); // (first position of each cell)
+    for(size_t i=0; i<n; i++){
+        unsigned int x = 0, y = 0;
+        if(high.x > low.x){ x = std::min(side-1, (unsigned int)((points[i].x-low.x)/(high.x-low.x)*side)); }
+        if(high.y > low.y){ y = std::min(side-1, (unsigned int)((points[i].y-low.y)/(high.y-low.y)*side)); }
+        cell[i] = y*side + x;
+        first[cell[i]+1] += 1;
+    }
+    for(size_t c=0; c<side*side; c++){
+        if(first[c+1] > 0){ start.push_back(base + first[c]); }
+        first[c+1] += first[c];
+    }
+    for(size_t i=0; i<n; i++){
+        order[first[cell[i]]++] = base + i;
+    }
+}
+
+// Merge all boundaries on this layer (in every instance) into trapezoids,
+// with walls only around the outside of the merged area; stops early if
+// (cancel) is set.
+void add_union(std::vector<int32_t>& vertices, std::vector<uint32_t>& indices, std::vector<uint32_t>& edges){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    float scale = 1000.0f; // (as in add_boundary())
+    SCANLINE scanline;
+    std::vector<int64_t> placed; // points in coordinates of top structure (rounded to database units)
+    size_t num_boundaries = 0;
+    gdsii_visit_instances(gdsii, [&](const GDSII_STRUCTURE* structure, const GDSII_TRANSFORM& transform){
+        uint32_t s = structure->index;
+        if(!layer->used[s] || (cancel != nullptr && *cancel)){ return false; }
+        for(uint32_t k=layer->start[s]; k<layer->start[s+1]; k++){
+            uint32_t e = layer->element[k];
+            const int32_t* xy = gdsii_element_xy(structure, e);
+            placed.clear();
+            for(uint32_t i=0; i<structure->point_count[e]; i++){
+                placed.push_back(llround(transform.a*xy[2*i] + transform.b*xy[2*i+1] + transform.tx));
+                placed.push_back(llround(transform.c*xy[2*i] + transform.d*xy[2*i+1] + transform.ty));
+            }
+            scanline_add_polygon(&scanline, placed.data(), placed.size()/2);
+            num_boundaries += 1;
+        }
+        return true;
+    });
+
+    std::vector<SCANLINE_TRAPEZOID> trapezoids;
+    std::vector<SCANLINE_WALL> walls;
+    scanline_union(&scanline, trapezoids, walls, cancel);
+    if(cancel != nullptr && *cancel){ return; }
+
+    // sort trapezoids and walls into tiles (see add_boundaries())
+    std::vector<glm::vec2> centers;
+    for(size_t i=0; i<trapezoids.size(); i++){
+        const SCANLINE_TRAPEZOID& t = trapezoids[i];
+        centers.push_back(glm::vec2(0.25*(t.left0+t.right0+t.left1+t.right1)/scale, 0.5*(t.y0+t.y1)/scale));
+    }
+    for(size_t i=0; i<walls.size(); i++){
+        centers.push_back(glm::vec2(0.5*(walls[i].x0+walls[i].x1)/scale, 0.5*(walls[i].y0+walls[i].y1)/scale));
+    }
+    std::vector<size_t> order(centers.size());
+    std::vector<size_t> tile_start;
+    grid_sort(centers, 1024, order.data(), 0, tile_start);
+    tile_start.push_back(order.size());
 
-    float* data = new float[vertices.size()];
-    for(unsigned int i=0; i<vertices.size(); i++){
-        data[i] = vertices[i];
+    MESH_MASTER master;
+    master.first_index = 0;
+    master.first_placement = 0;
+    master.num_placements = master.num_singles = 1;
+    master.first_tile = 0;
+    master.num_tiles = tile_start.size()-1;
+    master.first_group = master.num_tiles;
+    master.num_groups = 1;
+    master.min[0] = master.min[1] = std::numeric_limits<float>::max();
+    master.max[0] = master.max[1] = std::numeric_limits<float>::lowest();
+    master.first_wall = 0;
+    tiles.clear();
+    const int triangles[] = {0, 1, 2, 0, 2, 3};
+    for(size_t t=0; t+1<tile_start.size(); t++){
+        MESH_TILE tile;
+        tile.first = indices.size();
+        tile.first_wall = edges.size()/2;
+        size_t first_float = vertices.size();
+        for(size_t k=tile_start[t]; k<tile_start[t+1]; k++){
+            size_t i = order[k];
+            if(i < trapezoids.size()){
+                const SCANLINE_TRAPEZOID& z = trapezoids[i];
+                REAL points[] = {z.left0/scale, z.y0/scale, z.right0/scale, z.y0/scale,
+                                 z.right1/scale, z.y1/scale, z.left1/scale, z.y1/scale};
+                const REAL64 origin[] = {0, 0};
+                add_caps(vertices, indices, points, 4, triangles, 2, origin);
+            }else{
+                const SCANLINE_WALL& wall = walls[i-trapezoids.size()];
+                uint32_t p1 = vertices.size()/2;
+                int32_t ends[] = {(int32_t)llround(wall.x0), (int32_t)llround(wall.y0),
+                                  (int32_t)llround(wall.x1), (int32_t)llround(wall.y1)}; // (as in add_caps())
+                vertices.insert(vertices.end(), ends, ends+4);
+                add_wall(edges, p1, p1+1); // (merged area is on left)
+            }
+        }
+        tile.count = indices.size() - tile.first;
+        tile.num_walls = edges.size()/2 - tile.first_wall;
+        tile.min[0] = tile.min[1] = std::numeric_limits<float>::max();
+        tile.max[0] = tile.max[1] = std::numeric_limits<float>::lowest();
+        for(size_t i=first_float; i<vertices.size(); i+=2){ // (including ends of walls)
+            for(unsigned int a=0; a<2; a++){
+                tile.min[a] = std::min(tile.min[a], vertices[i+a]/scale);
+                tile.max[a] = std::max(tile.max[a], vertices[i+a]/scale);
+            }
+        }
+        for(unsigned int a=0; a<2; a++){
+            master.min[a] = std::min(master.min[a], tile.min[a]);
+            master.max[a] = std::max(master.max[a], tile.max[a]);
+        }
+        tiles.push_back(tile);
     }
-    num_vertices = vertices.size()/6;
+    master.num_indices = indices.size();
+    master.num_walls = edges.size()/2;
+
+    // everything in place, drawn once
+    masters.assign(1, master);
+    placements.assign(1, placement(gdsii_identity_transform(), scale));
+    MESH_TILE group = {0, 1, {master.min[0], master.min[1]}, {master.max[0], master.max[1]}, 0, 0};
+    tiles.push_back(group);
+    hull = convex_hull(vertices.data(), vertices.size()/2, 2, 1.0f/scale);
+
+    qDebug() << "Merged" << num_boundaries << "boundaries on layer" << gdslayer << "into"
+             << trapezoids.size() << "trapezoids and" << walls.size() << "walls in"
+             << std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() << "s";
+}
+
+// Copy (num_points) points (each x, y in (points), offsets from the origin
+// of their block in (origins); see pack()), (num_indices) indices of
+// triangle corners of caps, (num_edges) edges of sidewalls (each two point
+// numbers in (edges)), and (placements) to GPU memory, followed by the
+// bounding box of each master, which is drawn instead of the master where
+// it is too small on screen to show any detail. The vertex shader reads
+// points, origins and edges through buffer textures (see vertex_source).
+void upload(const int16_t* points, const int32_t* origins, size_t num_points, const uint32_t* corners, size_t num_indices,
+            const uint32_t* edges, size_t num_edges){
+    this->num_indices = num_indices;
+    num_triangles = 0;
+
+    std::vector<int32_t> box_vertices;
+    std::vector<uint32_t> box_indices;
+    std::vector<uint32_t> box_edges;
+    master_sizes.resize(masters.size());
+    for(size_t m=0; m<masters.size(); m++){
+        const MESH_MASTER& master = masters[m];
+        uint32_t base = box_vertices.size()/2; // (first point of box)
+        size_t first_corner = box_indices.size();
+        size_t first_edge = box_edges.size();
+        add_box(box_vertices, box_indices, box_edges, master.min, master.max);
+        for(size_t i=first_corner; i<box_indices.size(); i++){
+            box_indices[i] += 2*base;
+        }
+        for(size_t i=first_edge; i<box_edges.size(); i++){
+            box_edges[i] += base;
+        }
+        float magnification = 0.0f;
+        for(size_t p=master.first_placement; p<master.first_placement+master.num_placements; p++){
+            const float* linear = placements[p].linear;
+            magnification = std::max(magnification, std::sqrt(std::fabs(linear[0]*linear[3] - linear[1]*linear[2])));
+            num_triangles += (size_t)(placements[p].columns*placements[p].rows)*(master.num_indices/3 + 2*master.num_walls);
+        }
+        master_sizes[m] = magnification*std::max(master.max[0]-master.min[0], master.max[1]-master.min[1]);
+    }
+    std::vector<int16_t> box_points;
+    std::vector<int32_t> box_origins;
+    pack(box_vertices, box_indices, box_edges, box_points, box_origins);
+    for(size_t i=0; i<box_indices.size(); i++){
+        box_indices[i] += 2*num_points; // (after the points of the mesh, a whole number of blocks)
+    }
+    for(size_t i=0; i<box_edges.size(); i++){
+        box_edges[i] += num_points;
+    }
+    size_t num_origins = num_points/MESH_BLOCK_SIZE*2;
+    first_box = num_indices;
+    first_box_wall = num_edges;
 
     VAO = new QOpenGLVertexArrayObject();
     VBO = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    OBO = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    IBO = new QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+    EBO = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
     VAO->create();
     VAO->bind();
     VBO->create();
     VBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
     VBO->bind();
-    VBO->allocate(data, sizeof(float)*vertices.size());
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (void*)(3*sizeof(float)));
-    glEnableVertexAttribArray(1);
+    VBO->allocate(sizeof(int16_t)*(2*num_points + box_points.size()));
+    VBO->write(0, points, sizeof(int16_t)*2*num_points);
+    VBO->write(sizeof(int16_t)*2*num_points, box_points.data(), sizeof(int16_t)*box_points.size());
+    OBO->create();
+    OBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    OBO->bind();
+    OBO->allocate(sizeof(int32_t)*(num_origins + box_origins.size()));
+    OBO->write(0, origins, sizeof(int32_t)*num_origins);
+    OBO->write(sizeof(int32_t)*num_origins, box_origins.data(), sizeof(int32_t)*box_origins.size());
+    IBO->create();
+    IBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    IBO->bind(); // (recorded in VAO)
+    IBO->allocate(sizeof(uint32_t)*(num_indices + box_indices.size()));
+    IBO->write(0, corners, sizeof(uint32_t)*num_indices);
+    IBO->write(sizeof(uint32_t)*num_indices, box_indices.data(), sizeof(uint32_t)*box_indices.size());
+    EBO->create();
+    EBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    EBO->bind();
+    EBO->allocate(sizeof(uint32_t)*(2*num_edges + box_edges.size()));
+    EBO->write(0, edges, sizeof(uint32_t)*2*num_edges);
+    EBO->write(sizeof(uint32_t)*2*num_edges, box_edges.data(), sizeof(uint32_t)*box_edges.size());
+    PBO = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    PBO->create();
+    PBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    PBO->bind();
+    PBO->allocate(placements.data(), sizeof(MESH_PLACEMENT)*placements.size());
+    for(unsigned int i=2; i<5; i++){ // (pointers are set for each draw call)
+        glEnableVertexAttribArray(i);
+    }
     VAO->release();
 
-    if(shader == nullptr){
-        // shader won't compile vertex shader twice for some reason, so only do it once
-        // TODO: figure out why
-        shader = new QOpenGLShaderProgram();
-        shader->addShaderFromSourceCode(QOpenGLShader::Vertex, vertex_source);
-        shader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragment_source);
-        shader->link();
+    glGenTextures(1, &points_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, points_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG16I, VBO->bufferId());
+    glGenTextures(1, &origins_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, origins_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32I, OBO->bufferId());
+    glGenTextures(1, &edges_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, edges_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, EBO->bufferId());
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    GLint max_texels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    if(num_points + box_points.size()/2 > (size_t)max_texels || num_edges + box_edges.size()/2 > (size_t)max_texels){
+        qDebug() << "Warning: layer" << gdslayer << "has more points or edges than a buffer texture holds (" << max_texels << ")";
     }
 
-    delete[] data;
+    shader = Shader::get(vertex_source, fragment_source);
+    shader->bind();
+    glUniform1i(shader->uniform("points"), 0); // (texture units; see draw())
+    glUniform1i(shader->uniform("origins"), 1);
+    glUniform1i(shader->uniform("edges"), 2);
+    glUniform1f(shader->uniform("unit"), 1.0f/1000.0f); // (model units per database unit, as in add_boundary())
+
+    start_raster(points, origins, corners);
+
     initialized = true;
 }
 
+// Start rasterizing the top faces of the mesh in the background, and make
+// the quad they are drawn on (see draw_impostor()).
+void start_raster(const int16_t* points, const int32_t* origins, const uint32_t* corners){
+    raster_ready = false;
+    raster_cancel = false;
+    if(hull.empty()){ return; }
+    float min[2] = {hull[0].x, hull[0].y}, max[2] = {hull[0].x, hull[0].y};
+    for(unsigned int i=1; i<hull.size(); i++){
+        min[0] = std::min(min[0], hull[i].x); max[0] = std::max(max[0], hull[i].x);
+        min[1] = std::min(min[1], hull[i].y); max[1] = std::max(max[1], hull[i].y);
+    }
+    float quad[] = {
+        min[0], min[1], 0.0f, 0.0f,
+        max[0], min[1], 1.0f, 0.0f,
+        max[0], max[1], 1.0f, 1.0f,
+        min[0], max[1], 0.0f, 1.0f,
+    };
+    impostor_VAO = new QOpenGLVertexArrayObject();
+    impostor_VBO = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    impostor_VAO->create();
+    impostor_VAO->bind();
+    impostor_VBO->create();
+    impostor_VBO->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    impostor_VBO->bind();
+    impostor_VBO->allocate(quad, sizeof(quad));
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4*sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    impostor_VAO->release();
+
+    impostor_shader = Shader::get(impostor_vertex_source, impostor_fragment_source);
+
+    // copy the top faces (x, y of each corner) of each master, since
+    // (points) may be a mapped cache entry
+    std::vector<float> tops;
+    std::vector<size_t> top_start; // first float of each master (and total)
+    for(size_t m=0; m<masters.size(); m++){
+        top_start.push_back(tops.size());
+        for(size_t i=masters[m].first_index; i<(size_t)masters[m].first_index+masters[m].num_indices; i+=3){
+            if(corners[i] % 2 != 0){ continue; } // (on bottom face)
+            for(unsigned int j=0; j<3; j++){
+                size_t p = corners[i+j]/2;
+                size_t block = p/MESH_BLOCK_SIZE;
+                tops.push_back((origins[2*block] + points[2*p])/1000.0f);
+                tops.push_back((origins[2*block+1] + points[2*p+1])/1000.0f);
+            }
+        }
+    }
+    top_start.push_back(tops.size());
+    raster_create(&raster, min, max, raster_side);
+    raster_thread = std::thread(&Mesh::build_raster, this, std::move(tops), std::move(top_start));
+}
+
+// Rasterize (tops) (see start_raster()) at every placement of each master
+// (in the background; masters and placements are not changed until
+// deinitialize() stops this).
+void build_raster(std::vector<float> tops, std::vector<size_t> top_start){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(size_t m=0; m<masters.size(); m++){
+        const MESH_MASTER& master = masters[m];
+        for(size_t p=master.first_placement; p<master.first_placement+master.num_placements; p++){
+            const MESH_PLACEMENT& placed = placements[p];
+            for(unsigned int copy=0; copy<(unsigned int)(placed.columns*placed.rows); copy++){
+                if(raster_cancel){ return; }
+                unsigned int i = copy % (unsigned int)placed.columns, j = copy / (unsigned int)placed.columns;
+                float offset[2] = {placed.offset[0] + i*placed.column[0] + j*placed.row[0],
+                                   placed.offset[1] + i*placed.column[1] + j*placed.row[1]};
+                for(size_t t=top_start[m]; t<top_start[m+1]; t+=6){
+                    float corner[3][2];
+                    for(unsigned int k=0; k<3; k++){
+                        float x = tops[t+2*k], y = tops[t+2*k+1];
+                        corner[k][0] = placed.linear[0]*x + placed.linear[2]*y + offset[0];
+                        corner[k][1] = placed.linear[1]*x + placed.linear[3]*y + offset[1];
+                    }
+                    raster_triangle(&raster, corner[0], corner[1], corner[2]);
+                }
+            }
+        }
+    }
+    raster_pyramid(&raster);
+    qDebug() << "Rasterized layer" << gdslayer << "at" << raster.width[0] << "x" << raster.height[0] << "pixels in"
+             << std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() << "s";
+    raster_ready = true;
+}
+
+// Convex hull (counterclockwise) of (count) x-y positions, each (stride)
+// numbers after the last in (xy), scaled by (unit), by Andrew's monotone
+// chain. Points inside the octagon of the extreme points in eight
+// directions are discarded first, which leaves very few points to sort.
+template<typename T>
+static std::vector<glm::vec2> convex_hull(const T* xy, size_t count, size_t stride, float unit){
+    std::vector<glm::vec2> points;
+    if(count == 0){ return points; }
+    size_t end = count*stride;
+    const glm::vec2 directions[8] = { // (counterclockwise)
+        glm::vec2(1, 0), glm::vec2(1, 1), glm::vec2(0, 1), glm::vec2(-1, 1),
+        glm::vec2(-1, 0), glm::vec2(-1, -1), glm::vec2(0, -1), glm::vec2(1, -1)};
+    glm::vec2 extreme[8];
+    float extent[8];
+    for(unsigned int j=0; j<8; j++){
+        extreme[j] = glm::vec2(xy[0]*unit, xy[1]*unit);
+        extent[j] = glm::dot(extreme[j], directions[j]);
+    }
+    for(size_t i=0; i<end; i+=stride){
+        glm::vec2 p = glm::vec2(xy[i]*unit, xy[i+1]*unit);
+        for(unsigned int j=0; j<8; j++){
+            float d = glm::dot(p, directions[j]);
+            if(d > extent[j]){ extent[j] = d; extreme[j] = p; }
+        }
+    }
+    auto cross = [](glm::vec2 o, glm::vec2 a, glm::vec2 b){
+        return (a.x-o.x)*(b.y-o.y) - (a.y-o.y)*(b.x-o.x);
+    };
+    points.assign(extreme, extreme+8);
+    for(size_t i=0; i<end; i+=stride){
+        glm::vec2 p = glm::vec2(xy[i]*unit, xy[i+1]*unit);
+        bool inside = true;
+        for(unsigned int j=0; j<8; j++){
+            if(extreme[j] == extreme[(j+1)%8]){ continue; }
+            if(cross(extreme[j], extreme[(j+1)%8], p) <= 0){ inside = false; break; }
+        }
+        if(!inside){ points.push_back(p); }
+    }
+    std::sort(points.begin(), points.end(), [](glm::vec2 a, glm::vec2 b){
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    if(points.size() < 3){ return points; }
+    std::vector<glm::vec2> hull(2*points.size());
+    size_t k = 0;
+    for(size_t i=0; i<points.size(); i++){ // lower hull
+        while(k >= 2 && cross(hull[k-2], hull[k-1], points[i]) <= 0){ k--; }
+        hull[k++] = points[i];
+    }
+    for(size_t i=points.size()-1, t=k+1; i>0; i--){ // upper hull
+        while(k >= t && cross(hull[k-2], hull[k-1], points[i-1]) <= 0){ k--; }
+        hull[k++] = points[i-1];
+    }
+    hull.resize(k-1);
+    return hull;
+}
+
+// Triangulate one GDSII boundary, placed by (transform), and append its
+// points to (vertices) (in database units), the corners of its top and
+// bottom faces to (indices), and the edges of its sidewalls to (edges).
+//
+// The boundary is triangulated in coordinates relative to its first point
+// and then moved into place (see add_caps()), so the result depends only
+// on its shape. Layouts repeat shapes (contacts, vias, pieces of repeated
+// cells) many times, so the triangulations of non-convex shapes are kept
+// and reused.
+void add_boundary(std::vector<int32_t>& vertices, std::vector<uint32_t>& indices,
+                  std::vector<uint32_t>& edges, MeshScratch& scratch,
+                  const int32_t* xy, uint32_t count, const GDSII_TRANSFORM& transform) const {
+
+    float scale = 1000.0f; // (GDSII database units per model unit) TODO: update to use GDSII file units
+
+    // Loop through the points of the polygon in two passes.
+    // During the first pass, count the number of points, extract
+    // the points and calculate normal vectors to each edge, and
+    // determine whether the edge winds clockwise (CW) or
+    // counterclockwise (CCW).
+    std::vector<glm::vec2>& points = scratch.points;
+    std::vector<glm::vec2>& normals = scratch.normals;
+    std::vector<REAL64>& placed = scratch.placed; // points in coordinates of top structure
+    points.clear();
+    normals.clear();
+    placed.clear();
+    // skip repeated points (zero-length edges have no normal, and hang
+    // Triangle), including the last point, which is a duplicate of the first
+    for(unsigned int i=0; i<count; i++){
+        if(i > 0 && xy[2*i] == xy[2*i-2] && xy[2*i+1] == xy[2*i-1]){ continue; }
+        if(i == count-1 && xy[2*i] == xy[0] && xy[2*i+1] == xy[1]){ continue; }
+        placed.push_back(transform.a*xy[2*i] + transform.b*xy[2*i+1] + transform.tx);
+        placed.push_back(transform.c*xy[2*i] + transform.d*xy[2*i+1] + transform.ty);
+    }
+    unsigned int num_points = placed.size()/2;
+    if(num_points < 3){ return; }
+    std::vector<REAL64>& relative = scratch.relative;
+    relative.resize(placed.size());
+    for(unsigned int i=0; i<2*num_points; i++){
+        relative[i] = placed[i] - placed[i%2];
+    }
+    uint32_t first = vertices.size()/2; // (first point of this boundary)
+
+    REAL64 area = 0;
+    for(unsigned int i=0; i<num_points; i++){
+        const REAL64* point = &relative[2*i];
+        const REAL64* point_next = &relative[2*((i+1)%num_points)];
+        glm::vec2 scaled_point = glm::vec2(point[0]/scale, point[1]/scale);
+        glm::vec2 scaled_point_next = glm::vec2(point_next[0]/scale, point_next[1]/scale);
+        glm::vec2 normal = glm::vec2(scaled_point_next.y-scaled_point.y,
+                                     scaled_point.x-scaled_point_next.x);
+        normal /= glm::length(normal);
+        points.push_back(scaled_point);
+        normals.push_back(normal);
+        area += (point_next[0]-point[0])*(point_next[1]+point[1]); // 2 * area between line and x-axis
+    }
+    bool CW = area > 0; // polygon is clockwise if area is positive, CCW otherwise
+
+    // During the second pass, (1) offset each point along its
+    // adjacent edge normals by a small amount delta to help
+    // triangulate weird polygons, and (2) prepare to triangulate
+    // the polygon. Then create edge polygons between the points.
+    struct triangulateio in;
+    in.numberofpoints = num_points;
+    in.numberofpointattributes = 0;
+    in.pointmarkerlist = NULL;
+    scratch.pointlist.resize(in.numberofpoints * 2);
+    in.pointlist = scratch.pointlist.data();
+    in.numberofsegments = num_points;
+    in.segmentmarkerlist = NULL;
+    scratch.segmentlist.resize(in.numberofsegments * 2);
+    in.segmentlist = scratch.segmentlist.data();
+    in.numberofholes = 0;
+    in.holelist = NULL;
+    //in.numberofholes = num_points;
+    //in.holelist = (REAL *) malloc(in.numberofsegments * 2 * sizeof(REAL));
+    // (normals point out of the polygon, whichever way it winds)
+    if(CW){
+        for(unsigned int i=0; i<num_points; i++){ normals[i] = -normals[i]; }
+    }
+    for(unsigned int i=0; i<num_points; i++){
+
+        float delta = 0.01f;
+        //float delta = 0.1f/scale; // fix to database units
+
+        // move each point in along the normals of both its edges
+        glm::vec2 p1 = points[i] - delta*(normals[(i+num_points-1)%num_points] + normals[i]);
+
+        in.pointlist[i*2] = p1.x;
+        in.pointlist[i*2+1] = p1.y;
+        in.segmentlist[i*2] = i;
+        in.segmentlist[i*2+1] = (i+1) % num_points;
+
+        /*
+        glm::vec2 hole_marker = p1 + p2;
+        hole_marker *= 0.5;
+        hole_marker += 0.5f*delta*normal_1b;
+        in.holelist[i*2] = hole_marker.x;
+        in.holelist[i*2+1] = hole_marker.y;
+        */
+    }
+
+    // walls around the polygon counterclockwise, outside on their right,
+    // between its points (the first of the points of its caps, below)
+    for(unsigned int i=0; i<num_points; i++){
+        uint32_t p1 = first + i;
+        uint32_t p2 = first + (i+1)%num_points;
+        if(CW){ std::swap(p1, p2); }
+        add_wall(edges, p1, p2);
+    }
+
+    // Convex polygons (most of them, in layouts) are capped with a fan of
+    // triangles; only the others need a constrained triangulation.
+    if(is_convex(points)){
+        std::vector<int>& fan = scratch.trianglelist;
+        fan.clear();
+        for(unsigned int i=1; i+1<num_points; i++){
+            int triangle[] = {0, (int)i, (int)i+1};
+            if(CW){ std::swap(triangle[1], triangle[2]); }
+            fan.insert(fan.end(), triangle, triangle+3);
+        }
+        add_caps(vertices, indices, in.pointlist, num_points, fan.data(), num_points-2, placed.data());
+        scratch.num_fans += 1;
+    }else{
+        scratch.num_triangulated += 1;
+        auto found = scratch.shapes.find(relative);
+        if(found != scratch.shapes.end()){
+            const MeshTriangulation& triangulation = found->second;
+            add_caps(vertices, indices, triangulation.points.data(), triangulation.points.size()/2,
+                     triangulation.triangles.data(), triangulation.triangles.size()/3, placed.data());
+            scratch.num_repeated += 1;
+        }else{
+            triangulate_caps(vertices, indices, scratch, in, placed.data());
+        }
+    }
+}
+
+// Append the top and bottom faces of the boundary (in) (points and
+// segments, relative to (origin)), triangulated by Triangle, and keep the
+// triangulation for boundaries of the same shape (scratch.relative).
+void triangulate_caps(std::vector<int32_t>& vertices, std::vector<uint32_t>& indices, MeshScratch& scratch,
+                      struct triangulateio& in, const REAL64 origin[2]) const {
+    struct triangulateio out;
+
+    in.numberofregions = 0;
+    in.regionlist = NULL;
+    // need set of vertices, segments
+    // eventually, see which triangles border edge, on which side, etc...
+    // -p = planar straight line graph
+    // -z = number from zero
+    // -V = verbose
+    // -Q = quiet
+    out.pointlist = NULL;
+    out.pointmarkerlist = NULL;
+    out.trianglelist = NULL;
+    out.segmentlist = NULL;
+    out.segmentmarkerlist = NULL;
+    triangulate((char*)"pzQ", &in, &out, NULL);
+    add_caps(vertices, indices, out.pointlist, out.numberofpoints, out.trianglelist, out.numberoftriangles, origin);
+    if(scratch.shapes.size() < MeshScratch::max_shapes){
+        MeshTriangulation& triangulation = scratch.shapes[scratch.relative];
+        triangulation.points.assign(out.pointlist, out.pointlist + 2*out.numberofpoints);
+        triangulation.triangles.assign(out.trianglelist, out.trianglelist + 3*out.numberoftriangles);
+    }
+
+    free(out.pointlist);
+    free(out.pointmarkerlist);
+    free(out.trianglelist);
+    free(out.segmentlist);
+    free(out.segmentmarkerlist);
+}
+
+// Append the edge from point (p1) to point (p2) of a side face, whose
+// outside is on the right going from (p1) to (p2); the vertex shader
+// extrudes it into a quad whose triangles wind counterclockwise seen from
+// outside, like all others, so back faces can be culled.
+void add_wall(std::vector<uint32_t>& edges, uint32_t p1, uint32_t p2) const {
+    edges.push_back(p1);
+    edges.push_back(p2);
+}
+
+// Append a box over (min, max) in x and y (model units; numbered from the
+// first point appended): 12 corners of caps, and 4 edges of sidewalls.
+void add_box(std::vector<int32_t>& vertices, std::vector<uint32_t>& indices, std::vector<uint32_t>& edges,
+             const float min[2], const float max[2]) const {
+    uint32_t base = vertices.size()/2;
+    size_t first = indices.size();
+    REAL points[] = {min[0], min[1], max[0], min[1], max[0], max[1], min[0], max[1]}; // (counterclockwise)
+    const int triangles[] = {0, 1, 2, 0, 2, 3};
+    const REAL64 origin[] = {0, 0};
+    add_caps(vertices, indices, points, 4, triangles, 2, origin);
+    for(size_t i=first; i<indices.size(); i++){
+        indices[i] -= 2*base;
+    }
+    for(uint32_t i=0; i<4; i++){
+        add_wall(edges, i, (i+1)%4);
+    }
+}
+
+// Append the top and bottom faces of a boundary: (num_points) points (each
+// x, y in (points), in model units relative to (origin), in database
+// units) shared by (num_triangles) counterclockwise triangles (each three
+// point numbers in (triangles)). Point i is appended once, rounded to the
+// database grid, as index 2*i on the top face and 2*i+1 on the bottom face,
+// whose triangles are reversed so that it winds counterclockwise seen from
+// below.
+void add_caps(std::vector<int32_t>& vertices, std::vector<uint32_t>& indices,
+              const REAL* points, int num_points, const int* triangles, int num_triangles,
+              const REAL64 origin[2]) const {
+    REAL64 scale = 1000.0; // (as in add_boundary())
+    uint32_t top = vertices.size(); // (2 coordinates and 2 indices per point)
+    // TODO: move points to account for GDS hole problems
+    for(int i=0; i<num_points; i++){
+        vertices.push_back((int32_t)llround(origin[0] + points[2*i]*scale));
+        vertices.push_back((int32_t)llround(origin[1] + points[2*i+1]*scale));
+    }
+    for(int i=0; i<3*num_triangles; i++){
+        indices.push_back(top + 2*triangles[i]);
+    }
+    for(int i=0; i<num_triangles; i++){
+        indices.push_back(top + 2*triangles[3*i] + 1);
+        indices.push_back(top + 2*triangles[3*i+2] + 1);
+        indices.push_back(top + 2*triangles[3*i+1] + 1);
+    }
+}
+
+// Whether the polygon (points) (without repeated last point) is convex and
+// not self-intersecting: all turns are to the same side, and the edges
+// change direction only twice in x and twice in y. Axis-aligned rectangles,
+// the most common polygons by far, are recognized first.
+static bool is_convex(const std::vector<glm::vec2>& points){
+    size_t n = points.size();
+    if(n < 3){ return false; }
+    if(n == 4){
+        const glm::vec2* p = points.data();
+        if((p[0].x == p[1].x && p[1].y == p[2].y && p[2].x == p[3].x && p[3].y == p[0].y) ||
+           (p[0].y == p[1].y && p[1].x == p[2].x && p[2].y == p[3].y && p[3].x == p[0].x)){
+            return true;
+        }
+    }
+    float turn = 0; // (sign of first nonzero turn)
+    float first_dx = 0, first_dy = 0, last_dx = 0, last_dy = 0; // (nonzero edge directions)
+    unsigned int flips_x = 0, flips_y = 0;
+    for(size_t i=0; i<n; i++){
+        glm::vec2 edge = points[(i+1)%n] - points[i];
+        glm::vec2 next = points[(i+2)%n] - points[(i+1)%n];
+        float cross = edge.x*next.y - edge.y*next.x;
+        if(cross != 0){
+            if(turn == 0){ turn = cross; }
+            else if((cross > 0) != (turn > 0)){ return false; }
+        }
+        if(edge.x != 0){
+            if(last_dx != 0 && (edge.x > 0) != (last_dx > 0)){ flips_x++; }
+            if(first_dx == 0){ first_dx = edge.x; }
+            last_dx = edge.x;
+        }
+        if(edge.y != 0){
+            if(last_dy != 0 && (edge.y > 0) != (last_dy > 0)){ flips_y++; }
+            if(first_dy == 0){ first_dy = edge.y; }
+            last_dy = edge.y;
+        }
+    }
+    if((first_dx > 0) != (last_dx > 0)){ flips_x++; } // (around back to first edge)
+    if((first_dy > 0) != (last_dy > 0)){ flips_y++; }
+    return turn != 0 && flips_x <= 2 && flips_y <= 2;
+}
+
 void deinitialize(){
     initialized = false;
+    raster_cancel = true;
+    if(raster_thread.joinable()){ raster_thread.join(); }
+    raster_ready = false;
+    delete raster_texture;
+    raster_texture = nullptr;
+    delete impostor_VBO;
+    impostor_VBO = nullptr;
+    delete impostor_VAO;
+    impostor_VAO = nullptr;
+    glDeleteTextures(1, &points_texture);
+    glDeleteTextures(1, &origins_texture);
+    glDeleteTextures(1, &edges_texture);
+    points_texture = origins_texture = edges_texture = 0;
+    delete PBO;
+    delete EBO;
+    delete IBO;
+    delete OBO;
     delete VBO;
     delete VAO;
 }
@@ -283,26 +1441,232 @@ void deinitialize(){
     if(initialized){
         deinitialize();
     }
-    delete shader;
 }
 
-// draw mesh
-void render(glm::mat4 view, glm::mat4 rotate){
-    if(initialized){
-        // TODO: rotate normals
-        shader->bind();
-        unsigned int matlocation = glGetUniformLocation(shader->programId(), "transform");
-        glUniformMatrix4fv(matlocation, 1, GL_FALSE, glm::value_ptr(view));
-        unsigned int rotlocation = glGetUniformLocation(shader->programId(), "rotate");
-        glUniformMatrix4fv(rotlocation, 1, GL_FALSE, glm::value_ptr(rotate));
-        unsigned int collocation = glGetUniformLocation(shader->programId(), "color");
-        glUniform3fv(collocation, 1, glm::value_ptr(color));
-        VAO->bind();
-        glDrawArrays(GL_TRIANGLES, 0, num_vertices);
-        VAO->release();
-        glm::vec4 test = glm::vec4(1.0f,0.0f,0.0f, 1.0f);
-        test = rotate*test;
+// Queue the drawing of the mesh in (queue), placed in view coordinates by
+// (transform), with pixels (pixel_size) model units across. Instances of
+// masters smaller than (lod_pixels) pixels are drawn as their bounding
+// boxes, since at most a pixel or two of their detail would show.
+void render(RenderQueue& queue, glm::mat4 transform, float pixel_size = 0.0f){
+    if(!initialized){ return; }
+    RENDER_ITEM item = {transform, glm::vec4(color, 1.0f), glm::vec4(zbounds, 0.0f, 0.0f)};
+    if(use_impostor(transform, pixel_size)){
+        queue.add(impostor_shader, item, [this](){ draw_impostor(); });
+        return;
+    }
+    float lod_size = lod_pixels*pixel_size;
+    bool walls = !axial_view(transform); // (sidewalls are edge-on in top and bottom views)
+    glm::mat4 view = queue.projection*transform; // (to clip coordinates)
+    queue.add(shader, item, [this, view, lod_size, walls](){ draw(view, lod_size, walls); });
+}
+
+// Draw the mesh in (view) with the shader bound, masters smaller than
+// (lod_size) as boxes: first the caps, and then, if (walls), the sidewalls.
+void draw(const glm::mat4& view, float lod_size, bool walls){
+    VAO->bind();
+    PBO->bind();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, edges_texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, origins_texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, points_texture);
+    for(unsigned int pass=0; pass<(walls ? 2u : 1u); pass++){
+        bool sides = pass == 1;
+        glUniform1i(shader->uniform("walls"), sides);
+        // draw only the tiles in view
+        for(size_t m=0; m<masters.size(); m++){
+            const MESH_MASTER& master = masters[m];
+            if((sides ? master.num_walls : master.num_indices) == 0){ continue; }
+            bool boxed = master_sizes[m] < lod_size;
+            for(size_t g=master.first_group; g<master.first_group+master.num_groups; g++){
+                const MESH_TILE& group = tiles[g];
+                if(!in_view(view, group.min, group.max)){ continue; }
+                if(boxed){
+                    draw_box(m, group.first, group.count, 1, sides);
+                }else if(group.count == 1){
+                    draw_tiles(view, master, group.first, 1, sides);
+                }else{
+                    draw_master(master, group.first, group.count, 1, sides);
+                }
+            }
+            for(size_t p=master.first_placement+master.num_singles; p<master.first_placement+master.num_placements; p++){
+                unsigned int copies = (unsigned int)(placements[p].columns*placements[p].rows);
+                if(boxed){
+                    float min[2], max[2];
+                    placed_box(master.min, master.max, placements[p], min, max);
+                    if(in_view(view, min, max)){ draw_box(m, p, 1, copies, sides); }
+                }else{
+                    draw_tiles(view, master, p, copies, sides);
+                }
+            }
+        }
     }
+    VAO->release();
+    glFrontFace(GL_CCW);
+}
+
+// Draw (master) at (count) placements starting with (first), each a
+// lattice of (copies) copies, by one instanced draw call: the placement
+// attributes advance once every (copies) instances, and each copy finds
+// its place in the lattice from gl_InstanceID. Draws the caps, or the
+// sidewalls if (walls) (as set in the shader).
+void draw_master(const MESH_MASTER& master, size_t first, size_t count, unsigned int copies, bool walls){
+    use_placements(first, copies);
+    if(walls){
+        glDrawArraysInstanced(GL_TRIANGLES, 6*master.first_wall, 6*master.num_walls, count*copies);
+    }else{
+        glDrawElementsInstanced(GL_TRIANGLES, master.num_indices, GL_UNSIGNED_INT,
+                                (void*)(sizeof(uint32_t)*(size_t)master.first_index), count*copies);
+    }
+}
+
+// Direction of the z axis in view coordinates, by (transform) (see
+// RenderQueue); toward the viewer in top views.
+static glm::vec3 up(const glm::mat4& transform){
+    return glm::normalize(glm::vec3(transform*glm::vec4(0.0f, 0.0f, 1.0f, 0.0f)));
+}
+
+// Whether the view is along the z axis (to within about a quarter degree),
+// from the top or the bottom, so that sidewalls are (nearly) edge-on.
+static bool axial_view(const glm::mat4& transform){
+    return std::fabs(up(transform).z) >= 0.99999f;
+}
+
+// Whether to draw the top faces from (raster) instead of the mesh: in top
+// views, once the raster is as fine as the screen and the mesh has more
+// than (impostor_density) triangles per pixel it covers.
+bool use_impostor(const glm::mat4& transform, float pixel_size){
+    if(!raster_ready || pixel_size <= 0){ return false; }
+    if(!axial_view(transform) || up(transform).z < 0){ return false; } // (not looking down)
+    if(raster_pixel_size(&raster) > pixel_size){ return false; }
+    float area = (raster.max[0]-raster.min[0])*(raster.max[1]-raster.min[1])/(pixel_size*pixel_size); // (pixels)
+    return num_triangles > impostor_density*area;
+}
+
+// Draw the top faces as one quad at the top of the layer, covered where
+// the raster is, from the level of the raster as fine as the screen.
+void draw_impostor(){
+    if(raster_texture == nullptr){
+        raster_texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        raster_texture->setFormat(QOpenGLTexture::R8_UNorm);
+        raster_texture->setSize(raster.width[0], raster.height[0]);
+        raster_texture->setMipLevels(raster.level.size());
+        raster_texture->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::UInt8);
+        QOpenGLPixelTransferOptions options;
+        options.setAlignment(1); // (rows are not padded)
+        for(unsigned int i=0; i<raster.level.size(); i++){
+            raster_texture->setData(i, QOpenGLTexture::Red, QOpenGLTexture::UInt8, raster.level[i].data(), &options);
+            std::vector<uint8_t>().swap(raster.level[i]); // (only needed on GPU now)
+        }
+        raster_texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+        raster_texture->setMagnificationFilter(QOpenGLTexture::Linear);
+        raster_texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    }
+    raster_texture->bind();
+    impostor_VAO->bind();
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    impostor_VAO->release();
+}
+
+// Draw the bounding box of master (m) in place of the master, as in
+// draw_master().
+void draw_box(size_t m, size_t first, size_t count, unsigned int copies, bool walls){
+    use_placements(first, copies);
+    if(walls){
+        glDrawArraysInstanced(GL_TRIANGLES, 6*(first_box_wall + 4*m), 24, count*copies);
+    }else{
+        glDrawElementsInstanced(GL_TRIANGLES, 12, GL_UNSIGNED_INT,
+                                (void*)(sizeof(uint32_t)*(first_box + 12*m)), count*copies);
+    }
+}
+
+// Draw the tiles of (master) in (view) at placement (p), a lattice of
+// (copies) copies: their caps, or their sidewalls if (walls), as in
+// draw_master(). Runs of adjacent ranges are drawn as one, and a single
+// copy is drawn by one multi-draw call.
+void draw_tiles(const glm::mat4& view, const MESH_MASTER& master, size_t p, unsigned int copies, bool walls){
+    draw_counts.clear();
+    draw_offsets.clear();
+    draw_firsts.clear();
+    for(size_t t=master.first_tile; t<master.first_tile+master.num_tiles; t++){
+        const MESH_TILE& tile = tiles[t];
+        size_t count = walls ? tile.num_walls : tile.count;
+        if(count == 0){ continue; }
+        float min[2], max[2];
+        placed_box(tile.min, tile.max, placements[p], min, max);
+        if(!in_view(view, min, max)){ continue; }
+        if(walls){
+            add_range(6*(size_t)tile.first_wall, 6*count);
+        }else{
+            add_range(tile.first, count);
+        }
+    }
+    if(draw_counts.empty()){ return; }
+    use_placements(p, copies);
+    if(walls){
+        if(copies == 1){
+            glMultiDrawArrays(GL_TRIANGLES, draw_firsts.data(), draw_counts.data(), draw_counts.size());
+        }else{
+            for(size_t i=0; i<draw_counts.size(); i++){
+                glDrawArraysInstanced(GL_TRIANGLES, draw_firsts[i], draw_counts[i], copies);
+            }
+        }
+        return;
+    }
+    for(size_t i=0; i<draw_firsts.size(); i++){
+        draw_offsets.push_back((const GLvoid*)(sizeof(uint32_t)*(size_t)draw_firsts[i]));
+    }
+    if(copies == 1){
+        glMultiDrawElements(GL_TRIANGLES, draw_counts.data(), GL_UNSIGNED_INT, draw_offsets.data(), draw_counts.size());
+    }else{
+        for(size_t i=0; i<draw_counts.size(); i++){
+            glDrawElementsInstanced(GL_TRIANGLES, draw_counts[i], GL_UNSIGNED_INT, draw_offsets[i], copies);
+        }
+    }
+}
+
+// Add (count) indices (or vertices of sidewalls) from (first) to the
+// ranges to draw.
+void add_range(size_t first, size_t count){
+    if(count == 0){ return; }
+    if(!draw_counts.empty() && (size_t)draw_firsts.back() + draw_counts.back() == first){
+        draw_counts.back() += count;
+    }else{
+        draw_firsts.push_back(first);
+        draw_counts.push_back(count);
+    }
+}
+
+// Point the placement attributes at placement (first), advancing once
+// every (copies) instances. Placements drawn together are all mirrored or
+// all not, and front faces of mirrored ones wind clockwise.
+void use_placements(size_t first, unsigned int copies){
+    glFrontFace(mirrored(placements[first]) ? GL_CW : GL_CCW);
+    size_t offset = first*sizeof(MESH_PLACEMENT);
+    for(unsigned int i=0; i<3; i++){
+        glVertexAttribPointer(2+i, 4, GL_FLOAT, GL_FALSE, sizeof(MESH_PLACEMENT), (void*)(offset + 4*i*sizeof(float)));
+        glVertexAttribDivisor(2+i, copies);
+    }
+}
+
+// Whether any of the box (min, max) in x and y, and (zbounds) in z, may be
+// in view: false only if all its corners are beyond one clipping plane of
+// (view) (to clip coordinates).
+bool in_view(const glm::mat4& view, const float min[2], const float max[2]) const {
+    glm::vec4 corners[8];
+    for(unsigned int i=0; i<8; i++){
+        corners[i] = view*glm::vec4((i&1) ? max[0] : min[0], (i&2) ? max[1] : min[1], (i&4) ? zbounds[1] : zbounds[0], 1.0f);
+    }
+    for(unsigned int a=0; a<3; a++){
+        bool below = true, above = true;
+        for(unsigned int i=0; i<8; i++){
+            below = below && corners[i][a] < -corners[i][3];
+            above = above && corners[i][a] > corners[i][3];
+        }
+        if(below || above){ return false; }
+    }
+    return true;
 }
 
 glm::vec4 get_bounds(glm::mat4 transform){
@@ -310,12 +1674,17 @@ glm::vec4 get_bounds(glm::mat4 transform){
             std::numeric_limits<float>::lowest(),
             std::numeric_limits<float>::max(),
             std::numeric_limits<float>::lowest());
-    for(unsigned int i=0; i<mesh_points.size(); i++){
-        glm::vec4 pos = transform*glm::vec4(mesh_points[i], 1.0f);
-        if(pos[0] < bounds[0]) bounds[0] = pos[0]; // xmin
-        if(pos[0] > bounds[1]) bounds[1] = pos[0]; // xmax
-        if(pos[1] < bounds[2]) bounds[2] = pos[1]; // ymin
-        if(pos[1] > bounds[3]) bounds[3] = pos[1]; // ymax
+    if(!initialized){ return bounds; }
+    float z[] = {zbounds[0], zbounds[1]};
+    // the bounds of a convex hull under a linear transform are attained at its corners
+    for(unsigned int i=0; i<hull.size(); i++){
+        for(unsigned int j=0; j<2; j++){
+            glm::vec4 pos = transform*glm::vec4(hull[i].x, hull[i].y, z[j], 1.0f);
+            if(pos[0] < bounds[0]) bounds[0] = pos[0]; // xmin
+            if(pos[0] > bounds[1]) bounds[1] = pos[0]; // xmax
+            if(pos[1] < bounds[2]) bounds[2] = pos[1]; // ymin
+            if(pos[1] > bounds[3]) bounds[3] = pos[1]; // ymax
+        }
     }
     return bounds;
 }
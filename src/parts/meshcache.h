@@ -0,0 +1,280 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QString>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// On-disk cache of tessellated meshes, so that reopening an unchanged GDSII
+// file maps finished vertex buffers instead of parsing and triangulating.
+//
+// Each entry is one file named by a hash of the GDSII file contents, the
+// layer settings, and the tessellation options, holding a small header, the
+// convex hull of the mesh (for bounds), and the point, block origin, index,
+// edge, and placement buffers as stored in GPU memory, with the masters and
+// tiles they are divided into. Meshes are flat outlines extruded when
+// drawn, so entries do not depend on the z bounds of the layer. Entries are
+// written to a temporary file and renamed into place (QSaveFile), so other
+// gdsiiview processes sharing the cache only ever see complete entries.
+// Entries are evicted least recently used first once the cache grows past
+// (max_bytes); eviction is serialized between processes by a lock file.
+
+// Bump whenever the tessellation output or the entry format changes.
+#define MESH_CACHE_VERSION 10
+#define MESH_CACHE_OPTIONS "scale=1000 delta=0.01 convex=fan triangle=pzQ"
+
+// Points are stored as 16-bit offsets (database units) from the origin of
+// their block of MESH_BLOCK_SIZE consecutive points (see Mesh::pack()).
+#define MESH_BLOCK_SIZE 256
+
+// A mesh is drawn as one or more masters: the triangles of one structure
+// (or of everything drawn only once, in top structure coordinates), each
+// drawn at every one of its placements with one instanced draw call.
+struct MESH_MASTER{
+    quint32 first_index;        // top and bottom faces (caps) are triangles with indices
+    quint32 num_indices;        // first_index ... first_index+num_indices-1
+    quint32 first_wall;         // sidewalls are edges first_wall ... first_wall+num_walls-1
+    quint32 num_walls;
+    quint32 first_placement;    // placements are first_placement ... first_placement+num_placements-1,
+    quint32 num_placements;     // single placements first, then lattices
+    quint32 num_singles;
+    quint32 first_tile;         // triangles in tiles first_tile ... first_tile+num_tiles-1
+    quint32 num_tiles;
+    quint32 first_group;        // single placements in groups (tiles) first_group ... first_group+num_groups-1
+    quint32 num_groups;
+    float min[2], max[2];       // bounding box (x, y)
+};
+
+// Part of a master (a range of indices of its caps and a range of edges of
+// its sidewalls, in master coordinates) or a group of its single placements
+// (a range of placements, placed), with a bounding box, so that only the
+// tiles in view are drawn.
+struct MESH_TILE{
+    quint32 first;
+    quint32 count;
+    float min[2], max[2];       // bounding box (x, y)
+    quint32 first_wall;         // (zero for groups)
+    quint32 num_walls;
+};
+
+// Placement of a master, or of a lattice of (columns) x (rows) copies of a
+// master (AREF): x' = linear*x + offset + i*column + j*row for copy (i, j).
+struct MESH_PLACEMENT{
+    float linear[4];            // 2x2 matrix (column-major)
+    float offset[2];
+    float column[2];            // (zero for single placements)
+    float row[2];
+    float columns;
+    float rows;
+};
+
+struct MESH_CACHE_HEADER{
+    char magic[8];          // "GDSVMESH"
+    quint32 version;        // MESH_CACHE_VERSION
+    qint32 layer;
+    qint32 datatype;
+    quint32 num_hull;       // number of hull points (2 floats each) after header
+    quint64 num_points;     // number of points (2 int16 each) after hull, then of blocks
+                            // (origins, 2 int32 each; num_points/MESH_BLOCK_SIZE)
+    quint64 num_indices;    // number of index buffer entries after origins
+    quint64 num_edges;      // number of edges (2 point numbers each) after indices
+    quint32 num_masters;    // number of masters after edges
+    quint32 num_placements; // number of placements after masters
+    quint32 num_tiles;      // number of tiles after placements
+    quint32 reserved;
+};
+
+// An entry mapped into memory; valid until MeshCache::release().
+struct MeshCacheEntry{
+    QFile file;
+    uchar* data = nullptr;
+    const MESH_CACHE_HEADER* header = nullptr;
+    const float* hull = nullptr;
+    const qint16* points = nullptr;
+    const qint32* origins = nullptr;
+    const quint32* indices = nullptr;
+    const quint32* edges = nullptr;
+    const MESH_MASTER* masters = nullptr;
+    const MESH_PLACEMENT* placements = nullptr;
+    const MESH_TILE* tiles = nullptr;
+};
+
+class MeshCache{
+public:
+    QString directory;
+    qint64 max_bytes = 2LL*1024*1024*1024; // (bytes)
+
+MeshCache(){
+    directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/meshes";
+}
+
+bool ready(){
+    return !directory.isEmpty() && QDir().mkpath(directory);
+}
+
+// Hash of the contents of the file at (filepath). Hashing a large file takes
+// a while, so the result is remembered in a stamp file next to the entries
+// and reused as long as the file's size and modification time are unchanged.
+QByteArray file_key(const QString& filepath){
+    QFileInfo info(filepath);
+    QByteArray stamp = QByteArray::number(info.size()) + " " +
+                       QByteArray::number(info.lastModified().toMSecsSinceEpoch()) + " ";
+    QString stamppath = directory + "/" +
+        QCryptographicHash::hash(info.absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex() + ".stamp";
+
+    QFile stampfile(stamppath);
+    if(stampfile.open(QIODevice::ReadOnly)){
+        QByteArray saved = stampfile.readAll();
+        if(saved.startsWith(stamp)){ return saved.mid(stamp.size()); }
+    }
+
+    QFile file(filepath);
+    if(!file.open(QIODevice::ReadOnly)){ return QByteArray(); }
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    if(!hash.addData(&file)){ return QByteArray(); }
+    QByteArray key = hash.result().toHex();
+
+    QSaveFile newstamp(stamppath);
+    if(newstamp.open(QIODevice::WriteOnly)){
+        newstamp.write(stamp + key);
+        newstamp.commit();
+    }
+    return key;
+}
+
+// Key of the mesh of one layer of a file with key (file).
+static QByteArray mesh_key(const QByteArray& file, int layer, int datatype, bool merge){
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(file);
+    hash.addData(QByteArray::number(MESH_CACHE_VERSION) + " " + MESH_CACHE_OPTIONS);
+    hash.addData((const char*)&layer, sizeof(layer));
+    hash.addData((const char*)&datatype, sizeof(datatype));
+    hash.addData(QByteArray(merge ? "merge" : "separate"));
+    return hash.result().toHex();
+}
+
+QString entry_path(const QByteArray& key){
+    return directory + "/" + QString::fromLatin1(key) + ".mesh";
+}
+
+// Map the entry with (key) into memory, checking that it is complete and
+// matches the layer settings. Returns false on a miss.
+bool load(const QByteArray& key, int layer, int datatype, MeshCacheEntry& entry){
+    entry.file.setFileName(entry_path(key));
+    if(!entry.file.open(QIODevice::ReadOnly)){ return false; }
+    qint64 size = entry.file.size();
+    if(size < (qint64)sizeof(MESH_CACHE_HEADER)){ release(entry); return false; }
+    entry.data = entry.file.map(0, size);
+    if(entry.data == nullptr){ release(entry); return false; }
+
+    const MESH_CACHE_HEADER* header = (const MESH_CACHE_HEADER*)entry.data;
+    quint64 expected = sizeof(MESH_CACHE_HEADER) + 2*sizeof(float)*(quint64)header->num_hull +
+                       2*sizeof(qint16)*header->num_points + 2*sizeof(qint32)*(header->num_points/MESH_BLOCK_SIZE) +
+                       sizeof(quint32)*header->num_indices + 2*sizeof(quint32)*header->num_edges +
+                       sizeof(MESH_MASTER)*(quint64)header->num_masters + sizeof(MESH_PLACEMENT)*(quint64)header->num_placements +
+                       sizeof(MESH_TILE)*(quint64)header->num_tiles;
+    if(memcmp(header->magic, "GDSVMESH", 8) != 0 || header->version != MESH_CACHE_VERSION ||
+       header->layer != layer || header->datatype != datatype || header->num_points % MESH_BLOCK_SIZE != 0 ||
+       expected != (quint64)size){
+        release(entry);
+        return false;
+    }
+    entry.header = header;
+    entry.hull = (const float*)(entry.data + sizeof(MESH_CACHE_HEADER));
+    entry.points = (const qint16*)(entry.hull + 2*header->num_hull);
+    entry.origins = (const qint32*)(entry.points + 2*header->num_points);
+    entry.indices = (const quint32*)(entry.origins + 2*(header->num_points/MESH_BLOCK_SIZE));
+    entry.edges = entry.indices + header->num_indices;
+    entry.masters = (const MESH_MASTER*)(entry.edges + 2*header->num_edges);
+    entry.placements = (const MESH_PLACEMENT*)(entry.masters + header->num_masters);
+    entry.tiles = (const MESH_TILE*)(entry.placements + header->num_placements);
+
+    // mark as recently used, through a second handle, since setting the
+    // time of a file needs write access on Windows
+    QFile used(entry_path(key));
+    if(!used.open(QIODevice::ReadWrite) ||
+       !used.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime)){
+        qDebug() << "Warning: could not mark mesh cache entry as used:" << used.fileName();
+    }
+    return true;
+}
+
+void release(MeshCacheEntry& entry){
+    if(entry.data != nullptr){ entry.file.unmap(entry.data); }
+    entry.file.close();
+    entry.data = nullptr;
+    entry.header = nullptr;
+    entry.hull = nullptr;
+    entry.points = nullptr;
+    entry.origins = nullptr;
+    entry.indices = nullptr;
+    entry.edges = nullptr;
+    entry.masters = nullptr;
+    entry.placements = nullptr;
+    entry.tiles = nullptr;
+}
+
+void store(const QByteArray& key, int layer, int datatype,
+           const std::vector<float>& hull, const std::vector<int16_t>& points,
+           const std::vector<int32_t>& origins, const std::vector<uint32_t>& indices,
+           const std::vector<uint32_t>& edges,
+           const std::vector<MESH_MASTER>& masters,
+           const std::vector<MESH_PLACEMENT>& placements, const std::vector<MESH_TILE>& tiles){
+    MESH_CACHE_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "GDSVMESH", 8);
+    header.version = MESH_CACHE_VERSION;
+    header.layer = layer;
+    header.datatype = datatype;
+    header.num_hull = hull.size()/2;
+    header.num_points = points.size()/2;
+    header.num_indices = indices.size();
+    header.num_edges = edges.size()/2;
+    header.num_masters = masters.size();
+    header.num_placements = placements.size();
+    header.num_tiles = tiles.size();
+
+    QSaveFile file(entry_path(key));
+    if(!file.open(QIODevice::WriteOnly)){ return; }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)hull.data(), sizeof(float)*hull.size());
+    file.write((const char*)points.data(), sizeof(int16_t)*points.size());
+    file.write((const char*)origins.data(), sizeof(int32_t)*origins.size());
+    file.write((const char*)indices.data(), sizeof(uint32_t)*indices.size());
+    file.write((const char*)edges.data(), sizeof(uint32_t)*edges.size());
+    file.write((const char*)masters.data(), sizeof(MESH_MASTER)*masters.size());
+    file.write((const char*)placements.data(), sizeof(MESH_PLACEMENT)*placements.size());
+    file.write((const char*)tiles.data(), sizeof(MESH_TILE)*tiles.size());
+    if(!file.commit()){ return; }
+    evict();
+}
+
+// Remove least recently used entries until the cache fits in (max_bytes).
+void evict(){
+    QLockFile lock(directory + "/lock");
+    if(!lock.tryLock(1000)){ return; } // another process is already evicting
+    QFileInfoList entries = QDir(directory).entryInfoList(QStringList() << "*.mesh" << "*.stamp",
+                                                          QDir::Files, QDir::Time); // newest first
+    qint64 total = 0;
+    for(int i=0; i<entries.size(); i++){
+        total += entries[i].size();
+        if(total > max_bytes){
+            QFile::remove(entries[i].absoluteFilePath());
+        }
+    }
+}
+
+};
+
+#endif
@@ -4,12 +4,16 @@
 #include <QObject>
 #include <QFileSystemWatcher>
 #include <QFileInfo>
+#include <QDebug>
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
 #include <ctime>
 #include <limits>
 #include "glm/glm.hpp"
 #include "mesh.h"
+#include "meshcache.h"
 #include "gdsii.h"
 #include "image.h"
 
@@ -23,6 +27,8 @@ public:
 
     part_type type;
     bool initialized = false;
+    bool prepared = false; // (by prepare(), but not yet uploaded)
+    size_t num_uploaded = 0; // meshes uploaded by upload_next()
     bool created = false;
     bool hidden = false;
 
@@ -32,10 +38,13 @@ public:
 
     std::vector<std::shared_ptr<Mesh>>meshes;
     std::shared_ptr<Image> image;
-    GDSII* gdsii;
+    GDSII* gdsii = nullptr;
+    std::vector<GDSII_LAYER> layers; // index of boundaries on each layer drawn
+    uint8_t gdsii_reader = GDSII_READER_PARALLEL; // how to read GDSII file
+    bool use_cache = true; // whether to keep tessellated meshes on disk
+    MeshCache cache;
 
     glm::mat4 transform = glm::mat4(1.0f);
-    glm::mat4 rotate = glm::mat4(1.0f); // to help with normal rendering
 
 Part(){
     /*
@@ -44,56 +53,166 @@ Part(){
     */
 }
 
-void initialize(){
+// Read and tessellate everything to draw, with no OpenGL context, so this
+// can run on a background thread (see Loader): meshes come from the cache
+// where they can, and otherwise from the GDSII file, which is then read
+// only for the layers missing. Stops early, leaving the part unprepared,
+// once (cancel) is set; (progress) is told what is being done.
+void prepare(const std::atomic<bool>& cancel, std::function<void(const QString&)> progress){
+    prepare_files(cancel, progress);
+    for(unsigned int i=0; i<meshes.size(); i++){
+        meshes[i]->cancel = nullptr; // ((cancel) need not outlive this call)
+    }
+}
+
+// (see prepare())
+void prepare_files(const std::atomic<bool>& cancel, std::function<void(const QString&)> progress){
+    prepared = false;
+    num_uploaded = 0;
     if((filepath == "") || !(QFileInfo::exists(filepath) && QFileInfo(filepath).isFile())){
         qDebug() << "Error: part filepath invalid: " << filepath;
         return;
     }
+    QString filename = QFileInfo(filepath).fileName();
     //watcher->addPath(filepath);
     //watcher->files().removeDuplicates();
 
     if(type==PART_GDSII){
-        gdsii = gdsii_create_gdsii();
-        gdsii_read(gdsii, filepath.toStdString().c_str());
+        // free a library read by an earlier call
+        layers.clear();
+        if(gdsii != nullptr){
+            gdsii_delete_gdsii(gdsii);
+            gdsii = nullptr;
+        }
+
+        // reuse meshes tessellated earlier from the same file contents
+        progress("Looking up " + filename + " in mesh cache");
+        QByteArray file_key;
+        if(use_cache && cache.ready()){ file_key = cache.file_key(filepath); }
+        std::vector<std::shared_ptr<Mesh>> missing;
         for(unsigned int i=0; i<meshes.size(); i++){
-            meshes[i]->gdsii = gdsii;
-            meshes[i]->initialize();
+            meshes[i]->cache = nullptr;
+            meshes[i]->cancel = &cancel;
+            if(!file_key.isEmpty()){
+                meshes[i]->cache = &cache;
+                meshes[i]->cache_key = MeshCache::mesh_key(file_key, meshes[i]->gdslayer, meshes[i]->gdsdatatype, meshes[i]->merge);
+            }
+            if(!meshes[i]->prepare_from_cache()){ missing.push_back(meshes[i]); }
+        }
+        if(use_cache){
+            qDebug() << "Mesh cache:" << meshes.size()-missing.size() << "of" << meshes.size() << "layers found in" << cache.directory;
+        }
+        if(missing.empty()){
+            prepared = true;
+            return;
+        }
+        if(cancel){ return; }
+
+        // only read the layers that are drawn and not cached
+        progress("Reading " + filename);
+        GDSII_FILTER filter;
+        gdsii_create_filter(&filter);
+        for(unsigned int i=0; i<missing.size(); i++){
+            gdsii_filter_add(&filter, missing[i]->gdslayer, missing[i]->gdsdatatype);
         }
+        gdsii = gdsii_create_gdsii();
+        GDSII_READ_STATS stats;
+        gdsii_read(gdsii, filepath.toStdString().c_str(), gdsii_reader, &stats, &filter);
+        qDebug() << "Read" << filepath << ":" << stats.bytes << "bytes," << stats.records << "records in"
+                 << stats.seconds << "s (" << (stats.seconds > 0 ? stats.bytes/stats.seconds/1e6 : 0.0) << "MB/s,"
+                 << (gdsii_reader == GDSII_READER_STREAM ? "stream" : gdsii_reader == GDSII_READER_MAPPED ? "mapped" : "parallel") << "reader,"
+                 << gdsii_memory_usage(gdsii) << "bytes in memory)";
+        if(cancel){ return; }
+        // index all layers drawn in one pass over the library
+        progress("Indexing layers of " + filename);
+        layers.clear();
+        std::vector<unsigned int> mesh_layer(missing.size());
+        for(unsigned int i=0; i<missing.size(); i++){
+            unsigned int j = 0;
+            while(j < layers.size() && !(layers[j].layer == missing[i]->gdslayer && layers[j].datatype == missing[i]->gdsdatatype)){ j++; }
+            if(j == layers.size()){
+                layers.push_back(GDSII_LAYER());
+                layers[j].layer = missing[i]->gdslayer;
+                layers[j].datatype = missing[i]->gdsdatatype;
+            }
+            mesh_layer[i] = j;
+        }
+        gdsii_index_layers(gdsii, layers);
+        for(unsigned int i=0; i<missing.size(); i++){
+            if(cancel){ return; }
+            progress(QString("Tessellating layer %1 of %2 (%3/%4) of ").arg(i+1).arg(missing.size())
+                     .arg(missing[i]->gdslayer).arg(missing[i]->gdsdatatype) + filename);
+            missing[i]->gdsii = gdsii;
+            missing[i]->layer = &layers[mesh_layer[i]];
+            missing[i]->prepare();
+        }
+        if(cancel){ return; }
     }else if(type==PART_IMAGE){
-        image->initialize(filepath);
+        progress("Reading " + filename);
+        if(!image->prepare(filepath)){ return; }
     }
 
-    initialized = true;
+    prepared = true;
+}
+
+// Copy the next prepared mesh (or the image) to GPU memory, with the
+// OpenGL context current; returns true once there is nothing left to copy.
+// Uploading one mesh at a time lets the caller spread them over frames.
+bool upload_next(){
+    if(!prepared || initialized){ return true; }
+    if(type==PART_GDSII && num_uploaded < meshes.size()){
+        meshes[num_uploaded++]->upload_prepared();
+    }else if(type==PART_IMAGE){
+        image->upload();
+    }
+    initialized = type != PART_GDSII || num_uploaded == meshes.size();
+    return initialized;
+}
+
+// Prepare and upload in one go, with the OpenGL context current.
+void initialize(){
+    std::atomic<bool> cancel(false);
+    prepare(cancel, [](const QString&){});
+    while(!upload_next()){}
 }
 
 void deinitialize(){
     initialized = false;
+    prepared = false;
     if(type==PART_GDSII){
         for(unsigned int i=0; i<meshes.size(); i++){
-            meshes[i]->deinitialize();
+            if(meshes[i]->initialized){ meshes[i]->deinitialize(); }
+        }
+        layers.clear();
+        if(gdsii != nullptr){
+            gdsii_delete_gdsii(gdsii);
+            gdsii = nullptr;
         }
-        gdsii_delete_gdsii(gdsii);
     }else if(type==PART_IMAGE){
-        image->deinitialize();
+        if(image->initialized){ image->deinitialize(); }
+        image->release(); // (prepared, but maybe never uploaded)
     }
 }
 
 ~Part(){
-    if(initialized){
+    if(initialized || prepared || gdsii != nullptr){ // (possibly partly uploaded)
         deinitialize();
     }
     //delete watcher;
 }
 
-void render(glm::mat4 transform, glm::mat4 rotate){
+// Queue meshes and images in (queue), placed in view coordinates by
+// (transform). (pixel_size) is the size of a pixel on screen (model units;
+// part transforms only rotate and translate).
+void render(RenderQueue& queue, glm::mat4 transform, float pixel_size = 0.0f){
     if(!initialized){ return; }
     if(hidden){ return; }
     if(type==PART_GDSII){
         for(unsigned int i=0; i<meshes.size(); i++){
-            meshes[i]->render(transform * this->transform, rotate*this->rotate);
+            meshes[i]->render(queue, transform * this->transform, pixel_size);
         }
     }else if(type==PART_IMAGE){
-        image->render(transform * this->transform, rotate*this->rotate);
+        image->render(queue, transform * this->transform);
     }
 }
 
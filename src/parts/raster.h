@@ -0,0 +1,116 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Coverage of triangles on a pixel grid, by a scanline rasterizer, with a
+// pyramid of successively halved levels.
+//
+// The base level covers a rectangle (in model units) with square pixels
+// (as nearly as the rectangle allows), each fully covered (255) if its
+// center is inside any triangle and uncovered (0) otherwise, like the
+// pixels of the triangles drawn by the GPU. Each pixel of every further
+// level is the mean of (up to) four pixels of the level before, so each
+// level holds the fraction of its pixels covered, down to one pixel.
+
+struct RASTER{
+    float min[2], max[2];           // rectangle covered (model units)
+    std::vector<int> width;         // size of each level (pixels)
+    std::vector<int> height;
+    std::vector<std::vector<uint8_t>> level; // (rows from min[1] up)
+};
+
+// Start an uncovered raster of the rectangle (min, max) with about (side)
+// pixels along its longer side.
+inline void raster_create(RASTER* raster, const float min[2], const float max[2], int side){
+    float size[2] = {max[0]-min[0], max[1]-min[1]};
+    float longer = std::max(size[0], size[1]);
+    for(unsigned int a=0; a<2; a++){
+        (*raster).min[a] = min[a];
+        (*raster).max[a] = max[a];
+    }
+    int width = 1, height = 1;
+    if(longer > 0){
+        width = std::max(1, (int)ceil(side*size[0]/longer));
+        height = std::max(1, (int)ceil(side*size[1]/longer));
+    }
+    (*raster).width.assign(1, width);
+    (*raster).height.assign(1, height);
+    (*raster).level.assign(1, std::vector<uint8_t>((size_t)width*height, 0));
+}
+
+// Size of a base level pixel (model units).
+inline float raster_pixel_size(const RASTER* raster){
+    if((*raster).width.empty()){ return 0; }
+    return std::max(((*raster).max[0]-(*raster).min[0])/(*raster).width[0],
+                    ((*raster).max[1]-(*raster).min[1])/(*raster).height[0]);
+}
+
+// Cover the pixels of the base level whose centers are in the triangle
+// (a, b, c) (each x, y in model units; either orientation): for each row,
+// the span between the crossings of the row center with the triangle.
+inline void raster_triangle(RASTER* raster, const float a[2], const float b[2], const float c[2]){
+    int width = (*raster).width[0], height = (*raster).height[0];
+    double scale[2] = {width/((double)(*raster).max[0]-(*raster).min[0]),
+                       height/((double)(*raster).max[1]-(*raster).min[1])};
+    double p[3][2]; // (pixel coordinates)
+    const float* corners[3] = {a, b, c};
+    for(unsigned int i=0; i<3; i++){
+        p[i][0] = (corners[i][0]-(*raster).min[0])*scale[0];
+        p[i][1] = (corners[i][1]-(*raster).min[1])*scale[1];
+    }
+    double low = std::min(p[0][1], std::min(p[1][1], p[2][1]));
+    double high = std::max(p[0][1], std::max(p[1][1], p[2][1]));
+    int row0 = std::max(0, (int)ceil(low-0.5));
+    int row1 = std::min(height-1, (int)ceil(high-0.5)-1);
+    uint8_t* pixels = (*raster).level[0].data();
+    for(int row=row0; row<=row1; row++){
+        double y = row+0.5;
+        double left = INFINITY, right = -INFINITY;
+        for(unsigned int i=0; i<3; i++){
+            const double* s = p[i];
+            const double* t = p[(i+1)%3];
+            if((s[1] <= y) == (t[1] <= y)){ continue; } // (edge does not cross row center)
+            double x = s[0] + (t[0]-s[0])*((y-s[1])/(t[1]-s[1]));
+            left = std::min(left, x);
+            right = std::max(right, x);
+        }
+        if(!(left < right)){ continue; }
+        int column0 = std::max(0, (int)ceil(left-0.5));
+        int column1 = std::min(width-1, (int)ceil(right-0.5)-1);
+        if(column1 >= column0){
+            memset(pixels + (size_t)row*width + column0, 255, column1-column0+1);
+        }
+    }
+}
+
+// Build the levels after the base level.
+inline void raster_pyramid(RASTER* raster){
+    (*raster).width.resize(1);
+    (*raster).height.resize(1);
+    (*raster).level.resize(1);
+    while((*raster).width.back() > 1 || (*raster).height.back() > 1){
+        int width = (*raster).width.back(), height = (*raster).height.back();
+        int half_width = std::max(1, width/2), half_height = std::max(1, height/2);
+        std::vector<uint8_t> half((size_t)half_width*half_height);
+        const uint8_t* pixels = (*raster).level.back().data();
+        for(int row=0; row<half_height; row++){
+            int row0 = std::min(height-1, 2*row), row1 = std::min(height-1, 2*row+1);
+            for(int column=0; column<half_width; column++){
+                int column0 = std::min(width-1, 2*column), column1 = std::min(width-1, 2*column+1);
+                unsigned int sum = pixels[(size_t)row0*width + column0] + pixels[(size_t)row0*width + column1] +
+                                   pixels[(size_t)row1*width + column0] + pixels[(size_t)row1*width + column1];
+                half[(size_t)row*half_width + column] = (uint8_t)((sum+2)/4);
+            }
+        }
+        (*raster).width.push_back(half_width);
+        (*raster).height.push_back(half_height);
+        (*raster).level.push_back(std::move(half));
+    }
+}
+
+#endif
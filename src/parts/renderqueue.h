@@ -0,0 +1,126 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include "glm/glm.hpp"
+#include "shader.h"
+
+// Draws of one frame, collected from every part and then submitted
+// together.
+//
+// Each item is drawn by one shader program with its own transform, color,
+// and z bounds. Instead of setting these as uniforms of each program for
+// each draw, the queue puts those of all items in one uniform buffer (the
+// std140 block Items, at SHADER_ITEMS_BINDING), after the (projection) of
+// the frame, which is uploaded once per batch of (batch_size) items; items
+// are sorted by program, so each program is bound once per batch, and the
+// only uniform set for each item is its number in the block (item). An
+// item's draw function then binds its own vertex arrays and issues its
+// draw calls.
+//
+// Items are transformed to view coordinates (x right, y up, z toward the
+// viewer, each scaled alike), not to clip coordinates, so that
+// shaders can find the normal of each face from how the position in view
+// coordinates changes across the screen (see RENDER_SHADE_SOURCE) instead
+// of reading one for each vertex.
+
+// Declaration of the Items block and (item), for shaders drawn through the
+// queue; (batch_size) elements.
+#define RENDER_ITEMS_SOURCE "                           \n\
+    struct Item{ mat4 transform; vec4 color; vec4 zbounds; };\n\
+    layout (std140) uniform Items{ mat4 projection; Item items[170]; };\n\
+    uniform int item;                                   \n"
+
+// Lighting of (color) on a flat face through the fragment at (position)
+// (view coordinates), whose normal is that of the plane of the position
+// across neighboring fragments; for fragment shaders.
+#define RENDER_SHADE_SOURCE "                           \n\
+    vec3 shade(vec3 position, vec3 color){              \n\
+        vec3 normal = normalize(cross(dFdx(position), dFdy(position)));\n\
+        vec3 light1 = vec3(-0.70, 0.42, 0.58);          \n\
+        float diff1 = max(dot(light1, normal), 0.0);    \n\
+        vec3 light2 = vec3(0.70, -0.42, -0.58);         \n\
+        float diff2 = max(dot(light2, normal), 0.0);    \n\
+        float ambient = 0.1;                            \n\
+        return (ambient+2*(diff1+diff2*0.5))*color;     \n\
+    }                                                   \n"
+
+// One element of the Items block (std140 layout).
+struct RENDER_ITEM{
+    glm::mat4 transform;        // to view coordinates
+    glm::vec4 color;            // (r, g, b, unused)
+    glm::vec4 zbounds;          // (top, bottom, unused, unused)
+};
+
+class RenderQueue : protected QOpenGLFunctions_3_3_Core {
+public:
+    static const size_t batch_size = 170; // (items per upload, as declared in RENDER_ITEMS_SOURCE; 16 kB with the projection, the least block size GL allows)
+    struct ENTRY{
+        Shader* shader;
+        RENDER_ITEM item;
+        std::function<void()> draw;
+    };
+    std::vector<ENTRY> entries;
+    std::vector<size_t> order;
+    std::vector<RENDER_ITEM> uniforms;
+    glm::mat4 projection = glm::mat4(1.0f); // view coordinates to clip coordinates (set for each frame)
+    GLuint UBO = 0;
+
+RenderQueue(){
+    initializeOpenGLFunctions();
+    glGenBuffers(1, &UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) + sizeof(RENDER_ITEM)*batch_size, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+~RenderQueue(){
+    glDeleteBuffers(1, &UBO);
+}
+
+// Queue (draw), to be done with (shader) bound and (item) as the element
+// (item) of its Items block.
+void add(Shader* shader, const RENDER_ITEM& item, std::function<void()> draw){
+    ENTRY entry = {shader, item, draw};
+    entries.push_back(entry);
+}
+
+// Draw everything queued, and empty the queue.
+void submit(){
+    order.resize(entries.size());
+    for(size_t i=0; i<order.size(); i++){ order[i] = i; }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b){
+        return entries[a].shader < entries[b].shader;
+    });
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_ITEMS_BINDING, UBO);
+    for(size_t begin=0; begin<order.size(); begin+=batch_size){
+        size_t end = std::min(order.size(), begin+batch_size);
+        uniforms.resize(end-begin);
+        for(size_t i=begin; i<end; i++){
+            uniforms[i-begin] = entries[order[i]].item;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) + sizeof(RENDER_ITEM)*batch_size, nullptr, GL_STREAM_DRAW); // (orphan last batch)
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), &projection);
+        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(RENDER_ITEM)*uniforms.size(), uniforms.data());
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        Shader* bound = nullptr;
+        for(size_t i=begin; i<end; i++){
+            ENTRY& entry = entries[order[i]];
+            if(entry.shader != bound){
+                bound = entry.shader;
+                bound->bind();
+            }
+            glUniform1i(bound->uniform("item"), i-begin);
+            entry.draw();
+        }
+    }
+    entries.clear();
+}
+
+};
+
+#endif
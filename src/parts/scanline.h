@@ -0,0 +1,235 @@
+#ifndef SCANLINE_H
+#define SCANLINE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// Boolean union of polygons by a scanline sweep.
+//
+// Polygons (in integer database units) are split into non-horizontal edges.
+// The plane is swept upward in horizontal slabs between successive edge
+// endpoints (and edge crossings); within a slab, the edges are sorted by x,
+// and every x interval covered by at least one polygon becomes a trapezoid.
+// Trapezoids bounded by the same two edges in successive slabs are merged.
+// The result is a set of trapezoids with horizontal tops and bottoms that
+// covers the union exactly once, and the walls on the outer boundary of the
+// union (edges between covered and uncovered area), so abutting and
+// overlapping polygons have no faces between them.
+
+struct SCANLINE_EDGE{
+    double x0, y0;                  // lower endpoint
+    double x1, y1;                  // upper endpoint (y1 > y0)
+    int winding;                    // change in coverage when crossed in +x
+};
+
+struct SCANLINE_TRAPEZOID{
+    double y0, y1;                  // bottom and top
+    double left0, right0;           // x at bottom
+    double left1, right1;           // x at top
+};
+
+struct SCANLINE_WALL{               // boundary segment, with the union on its left
+    double x0, y0, x1, y1;
+};
+
+struct SCANLINE{
+    std::vector<SCANLINE_EDGE> edge;
+};
+
+// Add the polygon of (count) points (x, y) in (xy) (closed or not; either
+// orientation).
+inline void scanline_add_polygon(SCANLINE* scanline, const int64_t* xy, size_t count){
+    if(count < 3){ return; }
+    double area = 0;
+    for(size_t i=0; i<count; i++){
+        size_t j = (i+1)%count;
+        area += (double)(xy[2*j]-xy[2*i]) * (double)(xy[2*j+1]+xy[2*i+1]);
+    }
+    int orientation = area > 0 ? -1 : 1; // (area is positive if clockwise)
+    for(size_t i=0; i<count; i++){
+        size_t j = (i+1)%count;
+        if(xy[2*i+1] == xy[2*j+1]){ continue; } // (horizontal edges only matter at their ends)
+        SCANLINE_EDGE edge;
+        if(xy[2*i+1] < xy[2*j+1]){ // going up (right side of counterclockwise polygon)
+            edge = {(double)xy[2*i], (double)xy[2*i+1], (double)xy[2*j], (double)xy[2*j+1], -orientation};
+        }else{
+            edge = {(double)xy[2*j], (double)xy[2*j+1], (double)xy[2*i], (double)xy[2*i+1], orientation};
+        }
+        (*scanline).edge.push_back(edge);
+    }
+}
+
+inline double scanline_x(const SCANLINE_EDGE* edge, double y){
+    if(y <= (*edge).y0){ return (*edge).x0; }
+    if(y >= (*edge).y1){ return (*edge).x1; }
+    return (*edge).x0 + ((*edge).x1-(*edge).x0) * ((y-(*edge).y0) / ((*edge).y1-(*edge).y0));
+}
+
+// Append to (walls) the parts of the x axis covered by exactly one of the
+// interval lists (below) and (above) (sorted, disjoint) at height (y).
+inline void scanline_horizontal_walls(const std::vector<double>& below, const std::vector<double>& above,
+                                      double y, std::vector<SCANLINE_WALL>& walls){
+    size_t i = 0, j = 0;
+    bool in_below = false, in_above = false;
+    double start = 0;
+    while(i < below.size() || j < above.size()){
+        double x;
+        bool next_below = (j >= above.size()) || (i < below.size() && below[i] <= above[j]);
+        if(next_below){ x = below[i]; }else{ x = above[j]; }
+        bool was_below = in_below, was_above = in_above;
+        // apply all boundaries at x at once
+        while(i < below.size() && below[i] == x){ in_below = !in_below; i++; }
+        while(j < above.size() && above[j] == x){ in_above = !in_above; j++; }
+        if(was_below != was_above && x > start + 1e-6){ // (not just rounding error)
+            if(was_above){ walls.push_back({start, y, x, y}); } // union above: bottom face
+            else{ walls.push_back({x, y, start, y}); }          // union below: top face
+        }
+        start = x;
+    }
+}
+
+// Compute the union of all polygons added to (scanline), unless (cancel)
+// (if not NULL) is set first, which leaves the result incomplete.
+inline void scanline_union(SCANLINE* scanline, std::vector<SCANLINE_TRAPEZOID>& trapezoids,
+                           std::vector<SCANLINE_WALL>& walls, const std::atomic<bool>* cancel = NULL){
+    std::vector<SCANLINE_EDGE>& edges = (*scanline).edge;
+    if(edges.empty()){ return; }
+    std::sort(edges.begin(), edges.end(), [](const SCANLINE_EDGE& a, const SCANLINE_EDGE& b){
+        return a.y0 < b.y0;
+    });
+    std::vector<double> ys; // slab boundaries (crossings are added as they are found)
+    ys.reserve(2*edges.size());
+    for(size_t i=0; i<edges.size(); i++){
+        ys.push_back(edges[i].y0);
+        ys.push_back(edges[i].y1);
+    }
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+    struct OPEN{                    // trapezoid being extended upward
+        uint32_t left, right;       // bounding edges (first edge of each group at same place)
+        double y0, left0, right0;
+    };
+    std::vector<uint32_t> active;   // edges crossing current slab, sorted by x
+    std::vector<double> mid(edges.size()); // x of each active edge at middle of slab
+    std::vector<OPEN> open, next;   // trapezoids of previous and current slab
+    std::vector<int32_t> open_at(edges.size(), -1); // index in (open) by left edge
+    std::vector<uint8_t> continued;
+    std::vector<double> below, above; // covered intervals just below and above slab bottom
+    size_t next_edge = 0;
+
+    // close the trapezoids of the previous slab that do not continue
+    // into the next, and add walls between covered and uncovered area
+    auto close = [&](double y){
+        below.clear();
+        for(size_t o=0; o<open.size(); o++){
+            const SCANLINE_EDGE* l = &edges[open[o].left];
+            const SCANLINE_EDGE* r = &edges[open[o].right];
+            below.push_back(scanline_x(l, y));
+            below.push_back(scanline_x(r, y));
+            open_at[open[o].left] = -1;
+            if(continued[o]){ continue; }
+            SCANLINE_TRAPEZOID trapezoid = {open[o].y0, y, open[o].left0, open[o].right0,
+                                            scanline_x(l, y), scanline_x(r, y)};
+            trapezoids.push_back(trapezoid);
+            walls.push_back({trapezoid.left1, y, trapezoid.left0, trapezoid.y0});
+            walls.push_back({trapezoid.right0, trapezoid.y0, trapezoid.right1, y});
+        }
+        scanline_horizontal_walls(below, above, y, walls);
+    };
+
+    for(size_t k=0; k+1<ys.size(); k++){
+        if(cancel != NULL && *cancel){ return; }
+        double y = ys[k];
+        double y_next = ys[k+1];
+
+        // update active edges
+        size_t n = 0;
+        for(size_t i=0; i<active.size(); i++){
+            if(edges[active[i]].y1 > y){ active[n++] = active[i]; }
+        }
+        active.resize(n);
+        while(next_edge < edges.size() && edges[next_edge].y0 <= y){
+            if(edges[next_edge].y1 > y){ active.push_back(next_edge); }
+            next_edge++;
+        }
+
+        // sort edges by x within slab, lowering the top of the slab to the
+        // lowest crossing of neighboring edges until none cross within it
+        while(true){
+            double y_mid = 0.5*(y + y_next);
+            for(size_t i=0; i<active.size(); i++){ mid[active[i]] = scanline_x(&edges[active[i]], y_mid); }
+            for(size_t i=1; i<active.size(); i++){ // (insertion sort; order changes little between slabs)
+                uint32_t e = active[i];
+                size_t j = i;
+                while(j > 0 && mid[active[j-1]] > mid[e]){ active[j] = active[j-1]; j--; }
+                active[j] = e;
+            }
+            double y_cross = y_next;
+            for(size_t i=1; i<active.size(); i++){
+                const SCANLINE_EDGE* a = &edges[active[i-1]];
+                const SCANLINE_EDGE* b = &edges[active[i]];
+                double d0 = scanline_x(b, y) - scanline_x(a, y);
+                double d1 = scanline_x(b, y_next) - scanline_x(a, y_next);
+                if((d0 < 0 && d1 > 0) || (d0 > 0 && d1 < 0)){
+                    double yc = y + (y_next-y) * (d0 / (d0-d1));
+                    if(yc > y && yc < y_cross){ y_cross = yc; }
+                }
+            }
+            if(y_cross >= y_next){ break; }
+            y_next = y_cross;
+            ys.insert(ys.begin()+k+1, y_next);
+        }
+
+        // covered intervals are runs of positive coverage; edges at the
+        // same place (e.g., where polygons abut) are taken together
+        next.clear();
+        above.clear();
+        int coverage = 0;
+        uint32_t left = 0;
+        size_t i = 0;
+        while(i < active.size()){
+            uint32_t first = active[i];
+            double x0 = scanline_x(&edges[first], y);
+            double x1 = scanline_x(&edges[first], y_next);
+            int before = coverage;
+            while(i < active.size() && scanline_x(&edges[active[i]], y) == x0 &&
+                  scanline_x(&edges[active[i]], y_next) == x1){
+                coverage += edges[active[i]].winding;
+                i++;
+            }
+            if(before <= 0 && coverage > 0){
+                left = first;
+            }else if(before > 0 && coverage <= 0){
+                double left0 = scanline_x(&edges[left], y);
+                if(x0 > left0 || x1 > scanline_x(&edges[left], y_next)){ // (not empty)
+                    OPEN trapezoid = {left, first, y, left0, x0};
+                    next.push_back(trapezoid);
+                    above.push_back(left0);
+                    above.push_back(x0);
+                }
+            }
+        }
+
+        // continue trapezoids bounded by the same edges
+        continued.assign(open.size(), 0);
+        for(size_t t=0; t<next.size(); t++){
+            int32_t o = open_at[next[t].left];
+            if(o >= 0 && open[o].right == next[t].right){
+                next[t] = open[o];
+                continued[o] = 1;
+            }
+        }
+        close(y);
+        std::swap(open, next);
+        for(size_t o=0; o<open.size(); o++){ open_at[open[o].left] = o; }
+    }
+    above.clear();
+    continued.assign(open.size(), 0);
+    close(ys.back());
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QDebug>
+#include <map>
+#include <string>
+
+// Shader programs shared by every part drawn in one OpenGL context.
+//
+// Each variant (pair of vertex and fragment shader sources) is compiled
+// and linked the first time any mesh or image asks for it in the current
+// context; later requests get the same program. The locations of uniforms
+// are looked up once per program and remembered. Programs are deleted
+// with their context. A program with a uniform block Items (see
+// RenderQueue) reads it from binding point (SHADER_ITEMS_BINDING).
+
+#define SHADER_ITEMS_BINDING 0
+
+class Shader{
+public:
+    QOpenGLShaderProgram program;
+    std::map<std::string, int> locations; // (of uniforms, by name)
+
+// Location of uniform (name) (-1 if the program has none).
+int uniform(const char* name){
+    std::map<std::string, int>::iterator found = locations.find(name);
+    if(found != locations.end()){ return found->second; }
+    int location = program.uniformLocation(name);
+    locations[name] = location;
+    return location;
+}
+
+bool bind(){
+    return program.bind();
+}
+
+// The program made of (vertex_source) and (fragment_source) in the current
+// context, compiled if it is not there yet.
+static Shader* get(const char* vertex_source, const char* fragment_source){
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    std::map<std::string, Shader*>& shaders = registry()[context];
+    std::string key = std::string(vertex_source) + '\0' + fragment_source;
+    std::map<std::string, Shader*>::iterator found = shaders.find(key);
+    if(found != shaders.end()){ return found->second; }
+
+    if(shaders.empty() && context != nullptr){
+        QObject::connect(context, &QOpenGLContext::aboutToBeDestroyed, [context](){ release(context); });
+    }
+    Shader* shader = new Shader();
+    if(!shader->program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertex_source) ||
+       !shader->program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragment_source) ||
+       !shader->program.link()){
+        qDebug() << "Error: shader program failed to build:" << shader->program.log();
+    }else if(context != nullptr){
+        QOpenGLExtraFunctions* functions = context->extraFunctions();
+        GLuint block = functions->glGetUniformBlockIndex(shader->program.programId(), "Items");
+        if(block != GL_INVALID_INDEX){
+            functions->glUniformBlockBinding(shader->program.programId(), block, SHADER_ITEMS_BINDING);
+        }
+    }
+    shaders[key] = shader;
+    return shader;
+}
+
+// Delete the programs of (context) (while it is still current).
+static void release(QOpenGLContext* context){
+    std::map<std::string, Shader*>& shaders = registry()[context];
+    for(std::map<std::string, Shader*>::iterator i=shaders.begin(); i!=shaders.end(); i++){
+        delete i->second;
+    }
+    registry().erase(context);
+}
+
+private:
+static std::map<QOpenGLContext*, std::map<std::string, Shader*>>& registry(){
+    static std::map<QOpenGLContext*, std::map<std::string, Shader*>> shaders; // (by context, then by sources)
+    return shaders;
+}
+
+};
+
+#endif
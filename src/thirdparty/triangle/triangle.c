@@ -639,18 +639,31 @@ struct memorypool {
 };
 
 
+/* Thread-local storage.  gdsiiview calls triangulate() from several threads */
+/*   at once.  Each call already keeps its mesh in its own `struct mesh', but */
+/*   the constants below are rewritten by exactinit() on every call, and the */
+/*   random number seed is reset and advanced during every call; giving each */
+/*   thread its own copy keeps concurrent calls from racing on them and keeps */
+/*   the output of each call independent of the other threads.               */
+
+#ifdef _MSC_VER
+#define THREADLOCAL __declspec(thread)
+#else /* not _MSC_VER */
+#define THREADLOCAL __thread
+#endif /* not _MSC_VER */
+
 /* Global constants.                                                         */
 
-REAL splitter;       /* Used to split REAL factors for exact multiplication. */
-REAL epsilon;                             /* Floating-point machine epsilon. */
-REAL resulterrbound;
-REAL ccwerrboundA, ccwerrboundB, ccwerrboundC;
-REAL iccerrboundA, iccerrboundB, iccerrboundC;
-REAL o3derrboundA, o3derrboundB, o3derrboundC;
+THREADLOCAL REAL splitter; /* Used to split REAL factors for exact multiplication. */
+THREADLOCAL REAL epsilon;                 /* Floating-point machine epsilon. */
+THREADLOCAL REAL resulterrbound;
+THREADLOCAL REAL ccwerrboundA, ccwerrboundB, ccwerrboundC;
+THREADLOCAL REAL iccerrboundA, iccerrboundB, iccerrboundC;
+THREADLOCAL REAL o3derrboundA, o3derrboundB, o3derrboundC;
 
 /* Random number seed is not constant, but I've made it global anyway.       */
 
-unsigned long randomseed;                     /* Current random number seed. */
+THREADLOCAL unsigned long randomseed;         /* Current random number seed. */
 
 
 /* Mesh data structure.  Triangle operates on only one mesh, but the mesh    */
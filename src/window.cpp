@@ -3,6 +3,7 @@
 Window::Window(){
     canvas = new Canvas();
     setCentralWidget(canvas);
+    canvas->show_status = [this](const QString& message){ statusBar()->showMessage(message); };
 
     QMenu* file_menu = menuBar()->addMenu("&File");
     file_menu->addAction("&Open...",            [this]{canvas->file_open();}, QKeySequence(Qt::CTRL + Qt::Key_O));
@@ -21,6 +22,7 @@ Window::Window(){
     view_menu->addAction("&Top (+Z)",           [this]{canvas->view_orient(0.0f, 0.0f);});
     view_menu->addAction("B&ottom (-Z)",        [this]{canvas->view_orient(0.0f, 180.0f);});
     view_menu->addAction("&Isometric",          [this]{canvas->view_orient(45.0f, 54.73561f);});
+    view_menu->addAction("Measure &Overdraw",   [this]{canvas->measure_overdraw();});
 
     QMenu* help_menu = menuBar()->addMenu("&Help");
     help_menu->addAction("&About gdsiiview...", [this]{about();});
@@ -3,6 +3,7 @@
 
 #include <QMainWindow>  // subclass
 #include <QMenuBar>     // add menu items
+#include <QStatusBar>   // loading progress
 #include <QKeySequence> // menu keyboard shortcuts
 #include <QMessageBox>  // help->about dialog
 #include "canvas.h"     // 3D view